@@ -0,0 +1,267 @@
+/*
+** Copyright (c) 2014, Edward Funnekotter
+**
+** Permission to use, copy, modify, and/or distribute this software for
+** any purpose with or without fee is hereby granted, provided that the
+** above copyright notice and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+** WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+** BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+** OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+** WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+** SOFTWARE.
+*/
+
+#include "Arduino.h"
+#include "HIDCapture.h"
+
+
+// HIDCapture Methods
+
+HIDCapture::HIDCapture() :
+    lastTime_m(0),
+    started_m(false)
+{
+}
+
+void
+HIDCapture::record(
+    uint32_t time,
+    uint8_t id,
+    const void* data,
+    uint32_t len
+)
+{
+    uint8_t  header[MAX_HEADER];
+    uint8_t  n = 0;
+    uint32_t delta = started_m ? time - lastTime_m : 0;
+
+    lastTime_m = time;
+    started_m  = true;
+
+    do {
+        uint8_t val = delta & 0x7f;
+        delta >>= 7;
+        header[n++] = delta ? (val | 0x80) : val;
+    } while (delta);
+
+    if (len > 0xff) {
+        len = 0xff;
+    }
+    header[n++] = id;
+    header[n++] = len;
+
+    write(header, n, reinterpret_cast<const uint8_t*>(data), len);
+}
+
+uint8_t
+HIDCapture::decodeHeader(
+    const uint8_t* log,
+    uint32_t len,
+    uint32_t& delta,
+    uint8_t& id,
+    uint8_t& dataLen
+)
+{
+    uint8_t n = 0;
+    uint8_t shift = 0;
+
+    delta = 0;
+    while (true) {
+        if (n >= len || n >= MAX_HEADER - 2) {
+            return 0;
+        }
+        uint8_t val = log[n++];
+        delta |= (uint32_t)(val & 0x7f) << shift;
+        shift += 7;
+        if (!(val & 0x80)) {
+            break;
+        }
+    }
+
+    if ((uint32_t)n + 2 > len) {
+        return 0;
+    }
+    id      = log[n++];
+    dataLen = log[n++];
+    return n;
+}
+
+
+
+// HIDCaptureRing Methods
+
+HIDCaptureRing::HIDCaptureRing(uint8_t* buffer_p, uint16_t size) :
+    buffer_mp(buffer_p),
+    size_m(size),
+    head_m(0),
+    tail_m(0),
+    used_m(0),
+    dropped_m(0)
+{
+}
+
+void
+HIDCaptureRing::clear(void)
+{
+    head_m = tail_m = used_m = 0;
+}
+
+void
+HIDCaptureRing::put(uint8_t val)
+{
+    buffer_mp[head_m] = val;
+    if (++head_m == size_m) {
+        head_m = 0;
+    }
+    used_m++;
+}
+
+uint8_t
+HIDCaptureRing::peek(uint16_t offset)
+{
+    uint16_t pos = tail_m + offset;
+    if (pos >= size_m) {
+        pos -= size_m;
+    }
+    return buffer_mp[pos];
+}
+
+void
+HIDCaptureRing::dropOldest(void)
+{
+    uint16_t n = 0;
+    while (peek(n++) & 0x80) {
+    }
+    n += 2 + peek(n + 1);
+
+    tail_m += n;
+    if (tail_m >= size_m) {
+        tail_m -= size_m;
+    }
+    used_m -= n;
+    dropped_m++;
+}
+
+void
+HIDCaptureRing::write(
+    const uint8_t* header,
+    uint8_t headerLen,
+    const uint8_t* data,
+    uint8_t len
+)
+{
+    uint16_t needed = headerLen + len;
+    if (needed > size_m) {
+        dropped_m++;
+        return;
+    }
+
+    while (size_m - used_m < needed) {
+        dropOldest();
+    }
+
+    for (uint8_t i = 0; i < headerLen; i++) {
+        put(header[i]);
+    }
+    for (uint8_t i = 0; i < len; i++) {
+        put(data[i]);
+    }
+}
+
+// Reads whole records only, so that what has been read can always be
+// decoded on its own
+uint16_t
+HIDCaptureRing::read(uint8_t* data, uint16_t len)
+{
+    uint16_t n = 0;
+
+    while (used_m) {
+        uint16_t recLen = 0;
+        while (peek(recLen++) & 0x80) {
+        }
+        recLen += 2 + peek(recLen + 1);
+        if (n + recLen > len) {
+            break;
+        }
+        for (uint16_t i = 0; i < recLen; i++) {
+            data[n++] = buffer_mp[tail_m];
+            if (++tail_m == size_m) {
+                tail_m = 0;
+            }
+        }
+        used_m -= recLen;
+    }
+    return n;
+}
+
+
+
+// HIDReplay Methods
+
+HIDReplay::HIDReplay(
+    HIDGenericImpl::Transport* transport_p,
+    const uint8_t* log_p,
+    uint32_t len
+) :
+    transport_mp(transport_p),
+    log_mp(log_p),
+    len_m(len),
+    speed_m(1)
+{
+    restart();
+}
+
+void
+HIDReplay::restart(void)
+{
+    pos_m     = 0;
+    due_m     = 0;
+    reports_m = 0;
+    started_m = false;
+}
+
+bool
+HIDReplay::poll(void)
+{
+    uint8_t  p[64];
+    uint32_t delta;
+    uint8_t  id;
+    uint8_t  dataLen;
+
+    uint8_t n = HIDCapture::decodeHeader(log_mp + pos_m, len_m - pos_m,
+                                         delta, id, dataLen);
+    if (!n || pos_m + n + dataLen > len_m) {
+        return false;
+    }
+
+    uint32_t now = micros();
+    if (!started_m) {
+        // The first record's delta is 0 - it only starts the clock
+        start_m   = now;
+        started_m = true;
+    }
+    else if (speed_m) {
+        uint32_t due = due_m + delta / speed_m;
+        if ((int32_t)(now - start_m - due) < 0) {
+            return true;
+        }
+        due_m = due;
+    }
+
+    const uint8_t* data_p = log_mp + pos_m + n;
+    pos_m += n + dataLen;
+
+    if (dataLen > sizeof(p) - 1) {
+        dataLen = sizeof(p) - 1;
+    }
+    p[0] = id;
+    memcpy(p + 1, data_p, dataLen);
+    transport_mp->sendReport(p, dataLen + 1);
+
+    reports_m++;
+    return pos_m < len_m;
+}
@@ -0,0 +1,172 @@
+/*
+** Copyright (c) 2014, Edward Funnekotter
+**
+** Permission to use, copy, modify, and/or distribute this software for
+** any purpose with or without fee is hereby granted, provided that the
+** above copyright notice and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+** WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+** BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+** OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+** WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+** SOFTWARE.
+*/
+
+#ifndef __HIDCAPTURE_H__
+#define __HIDCAPTURE_H__
+
+#if defined __cplusplus
+
+#include "Arduino.h"
+#include "HIDGeneric.h"
+
+#if !defined(ARDUINO)
+#include <stdio.h>
+#endif
+
+// HIDCapture
+//
+// Records every report sent through HIDGenericImpl::sendReport in a
+// compact binary log. Each record is:
+//
+//   time  - microseconds since the previous record, as an unsigned
+//           LEB128 varint (7 bits per byte, high bit set on all but
+//           the last byte). The first record of a log always
+//           holds 0 - replay starts with it straight away.
+//   id    - report ID (one byte)
+//   len   - payload length (one byte)
+//   data  - len bytes of payload
+//
+// Capture is only compiled into HIDGenericImpl when HIDGENERIC_CAPTURE
+// is defined (see HIDGeneric.h). Attach a capture with
+// HIDGenericImpl::setCapture().
+//
+// HIDCapture only does the encoding - the derived classes decide
+// where the bytes go.
+
+class HIDCapture {
+  public:
+
+    // Longest encoding of a record header
+    static const uint8_t MAX_HEADER = 7;
+
+    HIDCapture();
+    virtual ~HIDCapture() {}
+
+    void record(uint32_t time, uint8_t id, const void* data, uint32_t len);
+
+    // Parse a record header from a log. Returns the number of bytes
+    // used or 0 if the log ends before the header does.
+    static uint8_t decodeHeader(const uint8_t* log, uint32_t len,
+                                uint32_t& delta, uint8_t& id, uint8_t& dataLen);
+
+  protected:
+
+    // Write one complete record
+    virtual void write(const uint8_t* header, uint8_t headerLen,
+                       const uint8_t* data, uint8_t len) = 0;
+
+  private:
+
+    uint32_t lastTime_m;
+    bool     started_m;
+};
+
+
+// HIDCaptureRing
+//
+// Keeps the most recent records in a RAM buffer supplied by the caller.
+// When the buffer is full the oldest complete records are thrown away
+// to make room, so the contents always start on a record boundary.
+// read() drains the log (for example to dump it over Serial).
+class HIDCaptureRing : public HIDCapture {
+  public:
+    HIDCaptureRing(uint8_t* buffer_p, uint16_t size);
+
+    uint16_t available(void) { return used_m; }
+    uint16_t read(uint8_t* data, uint16_t len);
+    void clear(void);
+
+    // Number of records thrown away to make room
+    uint16_t getDroppedRecords(void) { return dropped_m; }
+
+  protected:
+    virtual void write(const uint8_t* header, uint8_t headerLen,
+                       const uint8_t* data, uint8_t len);
+
+  private:
+    void put(uint8_t val);
+    uint8_t peek(uint16_t offset);
+    void dropOldest(void);
+
+    uint8_t*  buffer_mp;
+    uint16_t  size_m;
+    uint16_t  head_m;
+    uint16_t  tail_m;
+    uint16_t  used_m;
+    uint16_t  dropped_m;
+};
+
+
+#if !defined(ARDUINO)
+// HIDCaptureFile
+//
+// Host build only - appends the records to an open stdio file
+class HIDCaptureFile : public HIDCapture {
+  public:
+    HIDCaptureFile(FILE* file_p) : file_mp(file_p) {}
+
+  protected:
+    virtual void write(const uint8_t* header, uint8_t headerLen,
+                       const uint8_t* data, uint8_t len) {
+        fwrite(header, 1, headerLen, file_mp);
+        fwrite(data, 1, len, file_mp);
+    }
+
+  private:
+    FILE* file_mp;
+};
+#endif
+
+
+// HIDReplay
+//
+// Sends a captured log back out through a transport, for regression
+// testing and throughput measurements. The reports are sent with the
+// recorded spacing divided by the speed factor; a speed of 0 sends
+// them back to back. poll() never waits - call it from the main loop
+// until it returns false.
+//
+//   HIDGeneric<RN42<typeof Serial3> >::Transport transport(&rn42Obj);
+//   HIDReplay replay(&transport, log, logLen);
+//   while (replay.poll()) {}
+class HIDReplay {
+  public:
+    HIDReplay(HIDGenericImpl::Transport* transport_p,
+              const uint8_t* log_p, uint32_t len);
+
+    void setSpeed(uint8_t speed) { speed_m = speed; }
+    void restart(void);
+    bool poll(void);
+
+    // Number of reports sent so far
+    uint32_t getReportCount(void) { return reports_m; }
+
+  private:
+    HIDGenericImpl::Transport* transport_mp;
+    const uint8_t* log_mp;
+    uint32_t       len_m;
+    uint32_t       pos_m;
+    uint32_t       start_m;
+    uint32_t       due_m;
+    uint32_t       reports_m;
+    uint8_t        speed_m;
+    bool           started_m;
+};
+
+
+#endif
+#endif
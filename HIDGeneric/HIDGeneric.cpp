@@ -30,26 +30,22 @@
 
 #include "Arduino.h"
 #include "HIDGeneric.h"
+#ifdef HIDGENERIC_CAPTURE
+#include "HIDCapture.h"
+#endif
 
 //#ifdef HID_ENABLED
 
-//#define RAWHID_ENABLED
-
 
 //================================================================================
 //================================================================================
 
 //        HID report descriptor
 
-#define LSB(_x) ((_x) & 0xFF)
-#define MSB(_x) ((_x) >> 8)
+// Each device has its own collection - HIDGeneric puts together the
+// ones for the devices it was given
 
-#define RAWHID_USAGE_PAGE   0xFFC0
-#define RAWHID_USAGE        0x0C00
-#define RAWHID_TX_SIZE      64
-#define RAWHID_RX_SIZE      64
-
-const uint8_t HIDGenericImpl::hidReportDescriptor[192] = {
+const uint8_t HIDGenericImpl::Mouse::descriptor[DESCRIPTOR_SIZE] PROGMEM = {
     //        Mouse
     0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)        // 54
     0x09, 0x02,                    // USAGE (Mouse)
@@ -79,9 +75,11 @@ const uint8_t HIDGenericImpl::hidReportDescriptor[192] = {
     0x81, 0x06,                    //     INPUT (Data,Var,Rel)
     0xc0,                          //   END_COLLECTION
     0xc0,                          // END_COLLECTION
+};
 
+const uint8_t HIDGenericImpl::Keyboard::descriptor[DESCRIPTOR_SIZE] PROGMEM = {
     //        Keyboard
-    0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)        // 47
+    0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)        // 65
     0x09, 0x06,                    // USAGE (Keyboard)
     0xa1, 0x01,                    // COLLECTION (Application)
     0x85, 0x02,                    //   REPORT_ID (2)
@@ -99,6 +97,16 @@ const uint8_t HIDGenericImpl::hidReportDescriptor[192] = {
     0x75, 0x08,                    //   REPORT_SIZE (8)
     0x81, 0x03,                    //   INPUT (Cnst,Var,Abs)
 
+    0x95, 0x05,                    //   REPORT_COUNT (5)
+    0x75, 0x01,                    //   REPORT_SIZE (1)
+    0x05, 0x08,                    //   USAGE_PAGE (LEDs)
+    0x19, 0x01,                    //   USAGE_MINIMUM (Num Lock)
+    0x29, 0x05,                    //   USAGE_MAXIMUM (Kana)
+    0x91, 0x02,                    //   OUTPUT (Data,Var,Abs)
+    0x95, 0x01,                    //   REPORT_COUNT (1)
+    0x75, 0x03,                    //   REPORT_SIZE (3)
+    0x91, 0x03,                    //   OUTPUT (Cnst,Var,Abs)
+
     0x95, 0x06,                    //   REPORT_COUNT (6)
     0x75, 0x08,                    //   REPORT_SIZE (8)
     0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
@@ -109,27 +117,72 @@ const uint8_t HIDGenericImpl::hidReportDescriptor[192] = {
     0x29, 0x65,                    //   USAGE_MAXIMUM (Keyboard Application)
     0x81, 0x00,                    //   INPUT (Data,Ary,Abs)
     0xc0,                          // END_COLLECTION
+};
+
+const uint8_t HIDGenericImpl::ConsumerControl::descriptor[DESCRIPTOR_SIZE] PROGMEM = {
+    //        Consumer control
+    0x05, 0x0c,                    // USAGE_PAGE (Consumer Devices)       // 25
+    0x09, 0x01,                    // USAGE (Consumer Control)
+    0xa1, 0x01,                    // COLLECTION (Application)
+    0x85, 0x03,                    //   REPORT_ID (3)
+    0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+    0x26, 0xff, 0x03,              //   LOGICAL_MAXIMUM (1023)
+    0x19, 0x00,                    //   USAGE_MINIMUM (Unassigned)
+    0x2a, 0xff, 0x03,              //   USAGE_MAXIMUM (1023)
+    0x95, 0x04,                    //   REPORT_COUNT (4)
+    0x75, 0x10,                    //   REPORT_SIZE (16)
+    0x81, 0x00,                    //   INPUT (Data,Ary,Abs)
+    0xc0,                          // END_COLLECTION
+};
+
+const uint8_t HIDGenericImpl::Gamepad::descriptor[DESCRIPTOR_SIZE] PROGMEM = {
+    //        Gamepad
+    0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)        // 74 or 76
+    0x09, 0x05,                    // USAGE (Game Pad)
+    0xa1, 0x01,                    // COLLECTION (Application)
+    0x85, 0x04,                    //   REPORT_ID (4)
 
-#ifdef RAWHID_ENABLED
-    //        RAW HID
-    0x06, LSB(RAWHID_USAGE_PAGE), MSB(RAWHID_USAGE_PAGE),        // 30
-    0x0A, LSB(RAWHID_USAGE), MSB(RAWHID_USAGE),
-
-    0xA1, 0x01,                   // Collection 0x01
-    0x85, 0x03,                   // REPORT_ID (3)
-    0x75, 0x08,                     // report size = 8 bits
-    0x15, 0x00,                     // logical minimum = 0
-    0x26, 0xFF, 0x00,               // logical maximum = 255
-
-    0x95, 64,                     // report count TX
-    0x09, 0x01,                     // usage
-    0x81, 0x02,                     // Input (array)
-
-    0x95, 64,                     // report count RX
-    0x09, 0x02,                     // usage
-    0x91, 0x02,                     // Output (array)
-    0xC0                            // end collection
+    0x05, 0x09,                    //   USAGE_PAGE (Button)
+    0x19, 0x01,                    //   USAGE_MINIMUM (Button 1)
+    0x29, 0x20,                    //   USAGE_MAXIMUM (Button 32)
+    0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+    0x25, 0x01,                    //   LOGICAL_MAXIMUM (1)
+    0x75, 0x01,                    //   REPORT_SIZE (1)
+    0x95, 0x20,                    //   REPORT_COUNT (32)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+
+    0x05, 0x01,                    //   USAGE_PAGE (Generic Desktop)
+    0x09, 0x39,                    //   USAGE (Hat switch)
+    0x09, 0x39,                    //   USAGE (Hat switch)
+    0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+    0x25, 0x07,                    //   LOGICAL_MAXIMUM (7)
+    0x35, 0x00,                    //   PHYSICAL_MINIMUM (0)
+    0x46, 0x3b, 0x01,              //   PHYSICAL_MAXIMUM (315)
+    0x65, 0x14,                    //   UNIT (Eng Rot:Angular Pos)
+    0x75, 0x04,                    //   REPORT_SIZE (4)
+    0x95, 0x02,                    //   REPORT_COUNT (2)
+    0x81, 0x42,                    //   INPUT (Data,Var,Abs,Null)
+    0x65, 0x00,                    //   UNIT (None)
+    0x45, 0x00,                    //   PHYSICAL_MAXIMUM (0)
+
+    0x09, 0x30,                    //   USAGE (X)
+    0x09, 0x31,                    //   USAGE (Y)
+    0x09, 0x32,                    //   USAGE (Z)
+    0x09, 0x33,                    //   USAGE (Rx)
+    0x09, 0x34,                    //   USAGE (Ry)
+    0x09, 0x35,                    //   USAGE (Rz)
+#if HIDGENERIC_GAMEPAD_AXIS_BITS == 16
+    0x16, 0x01, 0x80,              //   LOGICAL_MINIMUM (-32767)
+    0x26, 0xff, 0x7f,              //   LOGICAL_MAXIMUM (32767)
+    0x75, 0x10,                    //   REPORT_SIZE (16)
+#else
+    0x15, 0x81,                    //   LOGICAL_MINIMUM (-127)
+    0x25, 0x7f,                    //   LOGICAL_MAXIMUM (127)
+    0x75, 0x08,                    //   REPORT_SIZE (8)
 #endif
+    0x95, 0x06,                    //   REPORT_COUNT (6)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+    0xc0,                          // END_COLLECTION
 };
 
 // typedef struct
@@ -171,15 +224,56 @@ const uint8_t HIDGenericImpl::hidReportDescriptor[192] = {
 
 #define WEAK __attribute__ ((weak))
 
+#ifdef HIDGENERIC_DEBUG
+#define DEBUG_PRINT(x)   Serial.print(x)
+#define DEBUG_PRINTLN(x) Serial.println(x)
+#else
+#define DEBUG_PRINT(x)
+#define DEBUG_PRINTLN(x)
+#endif
+
+// Stops the compiler from moving memory accesses across this point
+#define COMPILER_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
 
 // HIDGenericImpl Methods
 
 HIDGenericImpl::HIDGenericImpl(HIDGenericImpl::Transport* transport_p) :
-    mouse_m(this),
-    keyboard_m(this),
-    transport_mp(transport_p)
+    transport_mp(transport_p),
+    eventHead_m(0),
+    eventTail_m(0),
+    droppedEvents_m(0),
+    droppedBase_m(0),
+    transaction_m(0),
+    heldReports_m(0)
 {
-
+    // The queue indices are single bytes so they can be read and
+    // written atomically
+    typedef char queue_size_check[
+        (HIDGENERIC_EVENT_QUEUE_SIZE & EVENT_QUEUE_MASK) == 0 &&
+        HIDGENERIC_EVENT_QUEUE_SIZE <= 128 ? 1 : -1];
+    (void)sizeof(queue_size_check);
+
+    // One bit per report ID in heldReports_m
+    typedef char held_reports_check[MAX_REPORT_ID < 8 ? 1 : -1];
+    (void)sizeof(held_reports_check);
+
+#ifdef HIDGENERIC_CAPTURE
+    capture_mp = NULL;
+#endif
+#ifdef HIDGENERIC_STATS
+    queued_m = false;
+    resetStats();
+#endif
+#ifdef HIDGENERIC_RATE_LIMIT
+    memset(&link_m, 0, sizeof(link_m));
+    memset(rates_m, 0, sizeof(rates_m));
+    memset(priority_m, PRIORITY_HIGH, sizeof(priority_m));
+    priority_m[MOUSE_REPORT_ID]   = PRIORITY_LOW;
+    priority_m[GAMEPAD_REPORT_ID] = PRIORITY_NORMAL;
+    waiting_m = 0;
+    resetClassStats();
+#endif
 }
 
 void 
@@ -197,11 +291,348 @@ HIDGenericImpl::sendReport(
     uint8_t p[64];
     const uint8_t *d = reinterpret_cast<const uint8_t *>(data);
 
+#ifdef HIDGENERIC_STATS
+    // Reports caused by a queued event carry its timestamps, anything
+    // else is submitted and dequeued right now
+    uint32_t start   = micros();
+    uint32_t submit  = queued_m ? submitTime_m : start;
+    uint32_t dequeue = queued_m ? dequeueTime_m : start;
+#endif
+
     p[0] = id;
     for (uint32_t i=0; i<len; i++)
         p[i+1] = d[i];
-    Serial.println("Hid sending report");
+    DEBUG_PRINTLN("Hid sending report");
     transport_mp->sendReport(p, len+1);
+
+    // The device's whole state has gone, so nothing is held any more
+    if (id <= MAX_REPORT_ID) {
+        heldReports_m &= ~(1 << id);
+    }
+#ifdef HIDGENERIC_RATE_LIMIT
+    accountReport(id, len + 1);
+#endif
+
+#ifdef HIDGENERIC_CAPTURE
+    if (capture_mp) {
+        capture_mp->record(micros(), id, data, len);
+    }
+#endif
+
+#ifdef HIDGENERIC_STATS
+    recordStats(id, submit, dequeue, micros());
+#endif
+}
+
+#ifdef HIDGENERIC_STATS
+void
+HIDGenericImpl::recordStats(
+    uint8_t id,
+    uint32_t submit,
+    uint32_t dequeue,
+    uint32_t done
+)
+{
+    ReportStats& stats = stats_m[id <= MAX_REPORT_ID ? id : 0];
+    uint32_t latency  = done - submit;
+    uint32_t wait     = dequeue - submit;
+    uint32_t blocking = done - dequeue;
+
+    // Log scale bucket - the number of significant bits
+    uint8_t bucket = 0;
+    for (uint32_t v = latency; v && bucket < STATS_BUCKETS - 1; v >>= 1) {
+        bucket++;
+    }
+
+    if (stats.histogram[bucket] != 0xffff) {
+        stats.histogram[bucket]++;
+    }
+    if (stats.count != 0xffff) {
+        stats.count++;
+    }
+    if (latency > stats.maxLatency) {
+        stats.maxLatency = latency;
+    }
+    if (wait > stats.maxQueueWait) {
+        stats.maxQueueWait = wait;
+    }
+    if (blocking > stats.maxBlocking) {
+        stats.maxBlocking = blocking;
+    }
+}
+
+void
+HIDGenericImpl::resetStats(void)
+{
+    memset(stats_m, 0, sizeof(stats_m));
+}
+#endif
+
+#ifdef HIDGENERIC_RATE_LIMIT
+void
+HIDGenericImpl::setReportPriority(uint8_t id, uint8_t priority)
+{
+    if (id <= MAX_REPORT_ID && priority < PRIORITY_CLASSES) {
+        priority_m[id] = priority;
+    }
+}
+
+// The buckets start full
+void
+HIDGenericImpl::setReportRate(uint8_t id, uint16_t perSecond, uint8_t burst)
+{
+    if (id > MAX_REPORT_ID) {
+        return;
+    }
+    Bucket& bucket = rates_m[id];
+    bucket.interval = perSecond ? 1000000UL / perSecond : 0;
+    bucket.burst    = burst ? burst : 1;
+    bucket.credit   = (int32_t)bucket.interval * bucket.burst;
+    bucket.last     = micros();
+}
+
+void
+HIDGenericImpl::setLinkRate(uint16_t perSecond, uint8_t burst)
+{
+    link_m.interval = perSecond ? 1000000UL / perSecond : 0;
+    link_m.burst    = burst ? burst : 1;
+    link_m.credit   = (int32_t)link_m.interval * link_m.burst;
+    link_m.last     = micros();
+}
+
+void
+HIDGenericImpl::resetClassStats(void)
+{
+    memset(classStats_m, 0, sizeof(classStats_m));
+}
+
+// Refills the bucket for the time since it was last looked at and
+// checks it has the tokens. Asking for more than the burst means a
+// full bucket.
+bool
+HIDGenericImpl::hasTokens(Bucket& bucket, uint8_t tokens, uint32_t now)
+{
+    if (!bucket.interval) {
+        return true;
+    }
+
+    int32_t  full    = (int32_t)bucket.interval * bucket.burst;
+    uint32_t elapsed = now - bucket.last;
+
+    bucket.last = now;
+    if (elapsed >= (uint32_t)(full - bucket.credit)) {
+        bucket.credit = full;
+    }
+    else {
+        bucket.credit += elapsed;
+    }
+
+    if (tokens > bucket.burst) {
+        tokens = bucket.burst;
+    }
+    return bucket.credit >= (int32_t)bucket.interval * tokens;
+}
+
+void
+HIDGenericImpl::takeToken(Bucket& bucket, uint32_t now)
+{
+    if (bucket.interval) {
+        hasTokens(bucket, 0, now);
+        bucket.credit -= bucket.interval;
+    }
+}
+
+bool
+HIDGenericImpl::mayPass(uint8_t id, uint32_t now)
+{
+    uint8_t priority = priority_m[id];
+
+    // Held reports of a higher class go first
+    for (uint8_t i = 1; i <= MAX_REPORT_ID; i++) {
+        if ((waiting_m & (1 << i)) && priority_m[i] < priority) {
+            return false;
+        }
+    }
+    return hasTokens(rates_m[id], 1, now) && hasTokens(link_m, priority, now);
+}
+
+// Returns true if the limits hold the report back, and starts timing
+// its wait
+bool
+HIDGenericImpl::limitReport(uint8_t id)
+{
+    if (id > MAX_REPORT_ID || priority_m[id] == PRIORITY_HIGH) {
+        return false;
+    }
+
+    uint32_t now = micros();
+    if (mayPass(id, now)) {
+        return false;
+    }
+
+    if (!(waiting_m & (1 << id))) {
+        ClassStats& stats = classStats_m[priority_m[id]];
+        waiting_m |= 1 << id;
+        waitStart_m[id] = now;
+        if (stats.held != 0xffff) {
+            stats.held++;
+        }
+    }
+    return true;
+}
+
+bool
+HIDGenericImpl::isReportReady(void)
+{
+    uint8_t ready = heldReports_m & waiting_m;
+
+    if (transaction_m || !ready) {
+        return false;
+    }
+
+    uint32_t now = micros();
+    for (uint8_t id = 1; id <= MAX_REPORT_ID; id++) {
+        if ((ready & (1 << id)) && mayPass(id, now)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Charges a report that has been sent to the buckets and its class
+void
+HIDGenericImpl::accountReport(uint8_t id, uint32_t len)
+{
+    uint32_t now = micros();
+    uint8_t  priority = PRIORITY_HIGH;
+
+    takeToken(link_m, now);
+    if (id <= MAX_REPORT_ID) {
+        takeToken(rates_m[id], now);
+        priority = priority_m[id];
+    }
+
+    ClassStats& stats = classStats_m[priority];
+    stats.reports++;
+    stats.bytes += len;
+
+    if (id <= MAX_REPORT_ID && (waiting_m & (1 << id))) {
+        uint32_t wait = now - waitStart_m[id];
+        waiting_m &= ~(1 << id);
+        stats.totalWait += wait;
+        if (wait > stats.maxWait) {
+            stats.maxWait = wait;
+        }
+    }
+}
+#endif
+
+// Producer side of the event queue - safe to call from an interrupt
+bool
+HIDGenericImpl::queueEvent(
+    uint8_t type,
+    uint8_t a,
+    uint8_t b,
+    uint8_t c
+)
+{
+    uint8_t head = eventHead_m;
+    uint8_t next = (head + 1) & EVENT_QUEUE_MASK;
+
+    if (next == eventTail_m) {
+        droppedEvents_m++;
+        return false;
+    }
+
+    Event& event = events_m[head];
+    event.type    = type;
+    event.args[0] = a;
+    event.args[1] = b;
+    event.args[2] = c;
+#ifdef HIDGENERIC_STATS
+    event.time    = micros();
+#endif
+
+    // The event must be complete before the consumer can see it
+    COMPILER_BARRIER();
+    eventHead_m = next;
+    return true;
+}
+
+// Consumer side of the event queue - main loop only
+bool
+HIDGenericImpl::nextEvent(Event& event)
+{
+    uint8_t tail = eventTail_m;
+
+#ifdef HIDGENERIC_STATS
+    queued_m = false;
+#endif
+    if (tail == eventHead_m) {
+        return false;
+    }
+
+    COMPILER_BARRIER();
+    event = events_m[tail];
+    tail = (tail + 1) & EVENT_QUEUE_MASK;
+
+#ifdef HIDGENERIC_STATS
+    dequeueTime_m = micros();
+#endif
+
+    // Fold any directly following moves into this one as long as
+    // they fit in a single report
+    if (event.type == EVENT_MOUSE_MOVE) {
+        while (tail != eventHead_m) {
+            COMPILER_BARRIER();
+            const Event& next = events_m[tail];
+            if (next.type != EVENT_MOUSE_MOVE) {
+                break;
+            }
+            int x = (int8_t)event.args[0] + (int8_t)next.args[0];
+            int y = (int8_t)event.args[1] + (int8_t)next.args[1];
+            int w = (int8_t)event.args[2] + (int8_t)next.args[2];
+            if (x < -127 || x > 127 || y < -127 || y > 127 ||
+                w < -127 || w > 127) {
+                break;
+            }
+            event.args[0] = x;
+            event.args[1] = y;
+            event.args[2] = w;
+            tail = (tail + 1) & EVENT_QUEUE_MASK;
+        }
+    }
+
+    // Hand the slots back before the event is applied (and sent)
+    COMPILER_BARRIER();
+    eventTail_m = tail;
+
+#ifdef HIDGENERIC_STATS
+    // Any report sent before the next call comes from this event -
+    // merged moves are timed from the oldest one
+    submitTime_m = event.time;
+    queued_m     = true;
+#endif
+    return true;
+}
+
+// The counter is written by the interrupt handler, so re-read it until
+// two reads agree rather than disabling interrupts
+uint16_t
+HIDGenericImpl::getDroppedEvents(void)
+{
+    uint16_t dropped;
+    do {
+        dropped = droppedEvents_m;
+    } while (dropped != droppedEvents_m);
+
+    return dropped - droppedBase_m;
+}
+
+void
+HIDGenericImpl::resetDroppedEvents(void)
+{
+    droppedBase_m += getDroppedEvents();
 }
 
 
@@ -248,20 +679,14 @@ HIDGenericImpl::getInterface(uint8_t* interfaceNum)
     return 1;
 }
 
-int 
-HIDGenericImpl::getDescriptor(int i)
-{
-//    return transport_mp->sendControl(0,_hidReportDescriptor,sizeof(_hidReportDescriptor));
-    return 1;
-}
-
-
-
 // HIDGenericImpl::Mouse Methods
 
-HIDGenericImpl::Mouse::Mouse(HIDGenericImpl* hid_p) : 
-    hid_mp(hid_p),
-    buttons_m(0)
+HIDGenericImpl::Mouse::Mouse() : 
+    buttons_m(0),
+    sentButtons_m(0),
+    heldX_m(0),
+    heldY_m(0),
+    heldWheel_m(0)
 {
 }
 
@@ -274,44 +699,81 @@ void HIDGenericImpl::Mouse::end(void)
 {
 }
 
-void HIDGenericImpl::Mouse::click(uint8_t b)
+void HIDGenericImpl::Mouse::click(HIDGenericImpl& hid, uint8_t b)
 {
     buttons_m = b;
-    move(0,0,0);
+    move(hid,0,0,0);
     buttons_m = 0;
-    move(0,0,0);
+    move(hid,0,0,0);
+}
+
+static signed char clampMove(int16_t d)
+{
+    return d > 127 ? 127 : d < -127 ? -127 : d;
+}
+
+// Keeps a held back move within range however long it is held
+static int16_t addMove(int16_t held, signed char d)
+{
+    int16_t sum = held + d;
+    return sum > 0x3fff ? 0x3fff : sum < -0x3fff ? -0x3fff : sum;
 }
 
+// Moves are added up until the report can go, and a move too big for
+// one report carries on in the next. A button change is urgent, so the
+// rate limits don't merge away a click.
 void HIDGenericImpl::Mouse::move(
+    HIDGenericImpl& hid,
     signed char x, 
     signed char y, 
     signed char wheel
 )
 {
-    uint8_t m[4];
-    m[0] = buttons_m;
-    m[1] = x;
-    m[2] = y;
-    m[3] = wheel;
-    hid_mp->sendReport(1,m,4);
+    heldX_m = addMove(heldX_m, x);
+    heldY_m = addMove(heldY_m, y);
+    heldWheel_m = addMove(heldWheel_m, wheel);
+
+    while (!hid.holdReport(MOUSE_REPORT_ID, buttons_m != sentButtons_m)) {
+        uint8_t m[4];
+        m[0] = buttons_m;
+        m[1] = clampMove(heldX_m);
+        m[2] = clampMove(heldY_m);
+        m[3] = clampMove(heldWheel_m);
+        heldX_m -= (signed char)m[1];
+        heldY_m -= (signed char)m[2];
+        heldWheel_m -= (signed char)m[3];
+        sentButtons_m = buttons_m;
+        hid.sendReport(MOUSE_REPORT_ID,m,4);
+
+        if (!heldX_m && !heldY_m && !heldWheel_m) {
+            break;
+        }
+    }
+}
+
+void HIDGenericImpl::Mouse::commit(HIDGenericImpl& hid)
+{
+    if (hid.isReportHeld(MOUSE_REPORT_ID)) {
+        move(hid, 0, 0, 0);
+    }
 }
 
-void HIDGenericImpl::Mouse::buttons(uint8_t b)
+void HIDGenericImpl::Mouse::buttons(HIDGenericImpl& hid, uint8_t b)
 {
     if (b != buttons_m) {
         buttons_m = b;
-        move(0,0,0);
+        move(hid,0,0,0);
     }
 }
 
-void HIDGenericImpl::Mouse::press(uint8_t b)
+void HIDGenericImpl::Mouse::press(HIDGenericImpl& hid, uint8_t b)
 {
-    buttons(buttons_m | b);
+    buttons(hid, buttons_m | b);
 }
 
-void HIDGenericImpl::Mouse::release(uint8_t b)
+void HIDGenericImpl::Mouse::release(HIDGenericImpl& hid, uint8_t b)
 {
-    buttons(buttons_m & ~b);
+    buttons(hid, buttons_m & ~b);
 }
 
 bool HIDGenericImpl::Mouse::isPressed(uint8_t b)
@@ -319,14 +781,50 @@ bool HIDGenericImpl::Mouse::isPressed(uint8_t b)
     return ((b & buttons_m) == b);
 }
 
+bool HIDGenericImpl::Mouse::handleEvent(HIDGenericImpl& hid, const Event& event)
+{
+    switch (event.type) {
+    case EVENT_MOUSE_MOVE:
+        move(hid, event.args[0], event.args[1], event.args[2]);
+        return true;
+    case EVENT_MOUSE_PRESS:
+        press(hid, event.args[0]);
+        return true;
+    case EVENT_MOUSE_RELEASE:
+        release(hid, event.args[0]);
+        return true;
+    }
+    return false;
+}
+
 
 
 
 // HIDGenericImpl Keyboard Methods
 
-HIDGenericImpl::Keyboard::Keyboard(HIDGenericImpl* hid_p):
-    hid_mp(hid_p)
+HIDGenericImpl::Keyboard::Keyboard():
+    leds_m(0),
+    addedModifiers_m(0),
+    typeHead_m(0),
+    typeTail_m(0),
+    typed_m(0),
+    streak_m(0),
+    failedGap_m(0),
+    lastTyped_m(0),
+    utf8Code_m(0),
+    utf8Need_m(0),
+    utf8Low_m(0x80),
+    utf8High_m(0xbf),
+    unicodeMethod_m(UNICODE_NONE)
 {
+    typedef char type_ahead_check[
+        (HIDGENERIC_TYPE_AHEAD & TYPE_AHEAD_MASK) == 0 &&
+        HIDGENERIC_TYPE_AHEAD <= 128 ? 1 : -1];
+    (void)sizeof(type_ahead_check);
+
+    memset(&keys_m, 0, sizeof(keys_m));
+    setTypingProfile(TYPING_ADAPTIVE);
+    resetTypingRate();
 }
 
 void HIDGenericImpl::Keyboard::begin(void)
@@ -337,15 +835,46 @@ void HIDGenericImpl::Keyboard::end(void)
 {
 }
 
-void HIDGenericImpl::Keyboard::sendReport(KeyReport* keys)
+void HIDGenericImpl::Keyboard::sendReport(HIDGenericImpl& hid)
 {
-    Serial.println("Sending report");
-    hid_mp->sendReport(2,keys,sizeof(KeyReport));
+    if (hid.holdReport(KEYBOARD_REPORT_ID)) {
+        return;
+    }
+    DEBUG_PRINTLN("Sending report");
+    hid.sendReport(KEYBOARD_REPORT_ID,&keys_m,sizeof(KeyReport));
+}
+
+void HIDGenericImpl::Keyboard::commit(HIDGenericImpl& hid)
+{
+    if (hid.isReportHeld(KEYBOARD_REPORT_ID)) {
+        sendReport(hid);
+    }
 }
 
-static const uint32_t SHIFT_KEY = 0x80;
-const uint8_t HIDGenericImpl::Keyboard::asciimap[128] =
+// Keymap
+//
+// One entry per input byte, so press() and release() need a single
+// lookup whatever kind of key they are given. The low byte of an entry
+// is the usage to put in the report and the high byte the modifiers to
+// go with it:
+//
+//   0x00 - 0x7f  printing characters (HIDGENERIC_LAYOUT)
+//   0x80 - 0x87  modifier keys - no usage, just the modifier bit
+//   0x88 - 0xff  non-printing keys - usage is the value minus 136
+//
+// Usages never go above 0x7f, so bit 7 of the usage byte marks the
+// letters, whose SHIFT is flipped when the host has Caps Lock on.
+// A zero entry means there is nothing to send - including characters
+// that are dead keys on the layout, which writeCodepoint() handles.
+#define KEYMAP_SHIFT        0x0200       // left shift modifier
+#define KEYMAP_ALTGR        0x4000       // right alt (AltGr) modifier
+#define KEYMAP_LETTER       0x0080       // affected by Caps Lock
+#define KEYMAP_MODIFIER(n)  (0x0100 << (n))
+#define KEYMAP_KEYS8(u)     (u), (u)+1, (u)+2, (u)+3, (u)+4, (u)+5, (u)+6, (u)+7
+
+const uint16_t HIDGenericImpl::Keyboard::keymap[256] PROGMEM =
 {
+#if HIDGENERIC_LAYOUT == HIDGENERIC_LAYOUT_US
     0x00,             // NUL
     0x00,             // SOH
     0x00,             // STX
@@ -380,17 +909,17 @@ const uint8_t HIDGenericImpl::Keyboard::asciimap[128] =
     0x00,             // US
 
     0x2c,                   //  ' '
-    0x1e|SHIFT_KEY,           // !
-    0x34|SHIFT_KEY,           // "
-    0x20|SHIFT_KEY,    // #
-    0x21|SHIFT_KEY,    // $
-    0x22|SHIFT_KEY,    // %
-    0x24|SHIFT_KEY,    // &
+    0x1e|KEYMAP_SHIFT,           // !
+    0x34|KEYMAP_SHIFT,           // "
+    0x20|KEYMAP_SHIFT,    // #
+    0x21|KEYMAP_SHIFT,    // $
+    0x22|KEYMAP_SHIFT,    // %
+    0x24|KEYMAP_SHIFT,    // &
     0x34,          // '
-    0x26|SHIFT_KEY,    // (
-    0x27|SHIFT_KEY,    // )
-    0x25|SHIFT_KEY,    // *
-    0x2e|SHIFT_KEY,    // +
+    0x26|KEYMAP_SHIFT,    // (
+    0x27|KEYMAP_SHIFT,    // )
+    0x25|KEYMAP_SHIFT,    // *
+    0x2e|KEYMAP_SHIFT,    // +
     0x36,          // ,
     0x2d,          // -
     0x37,          // .
@@ -405,159 +934,727 @@ const uint8_t HIDGenericImpl::Keyboard::asciimap[128] =
     0x24,          // 7
     0x25,          // 8
     0x26,          // 9
-    0x33|SHIFT_KEY,      // :
+    0x33|KEYMAP_SHIFT,      // :
     0x33,          // ;
-    0x36|SHIFT_KEY,      // <
+    0x36|KEYMAP_SHIFT,      // <
     0x2e,          // =
-    0x37|SHIFT_KEY,      // >
-    0x38|SHIFT_KEY,      // ?
-    0x1f|SHIFT_KEY,      // @
-    0x04|SHIFT_KEY,      // A
-    0x05|SHIFT_KEY,      // B
-    0x06|SHIFT_KEY,      // C
-    0x07|SHIFT_KEY,      // D
-    0x08|SHIFT_KEY,      // E
-    0x09|SHIFT_KEY,      // F
-    0x0a|SHIFT_KEY,      // G
-    0x0b|SHIFT_KEY,      // H
-    0x0c|SHIFT_KEY,      // I
-    0x0d|SHIFT_KEY,      // J
-    0x0e|SHIFT_KEY,      // K
-    0x0f|SHIFT_KEY,      // L
-    0x10|SHIFT_KEY,      // M
-    0x11|SHIFT_KEY,      // N
-    0x12|SHIFT_KEY,      // O
-    0x13|SHIFT_KEY,      // P
-    0x14|SHIFT_KEY,      // Q
-    0x15|SHIFT_KEY,      // R
-    0x16|SHIFT_KEY,      // S
-    0x17|SHIFT_KEY,      // T
-    0x18|SHIFT_KEY,      // U
-    0x19|SHIFT_KEY,      // V
-    0x1a|SHIFT_KEY,      // W
-    0x1b|SHIFT_KEY,      // X
-    0x1c|SHIFT_KEY,      // Y
-    0x1d|SHIFT_KEY,      // Z
+    0x37|KEYMAP_SHIFT,      // >
+    0x38|KEYMAP_SHIFT,      // ?
+    0x1f|KEYMAP_SHIFT,      // @
+    0x04|KEYMAP_SHIFT|KEYMAP_LETTER,      // A
+    0x05|KEYMAP_SHIFT|KEYMAP_LETTER,      // B
+    0x06|KEYMAP_SHIFT|KEYMAP_LETTER,      // C
+    0x07|KEYMAP_SHIFT|KEYMAP_LETTER,      // D
+    0x08|KEYMAP_SHIFT|KEYMAP_LETTER,      // E
+    0x09|KEYMAP_SHIFT|KEYMAP_LETTER,      // F
+    0x0a|KEYMAP_SHIFT|KEYMAP_LETTER,      // G
+    0x0b|KEYMAP_SHIFT|KEYMAP_LETTER,      // H
+    0x0c|KEYMAP_SHIFT|KEYMAP_LETTER,      // I
+    0x0d|KEYMAP_SHIFT|KEYMAP_LETTER,      // J
+    0x0e|KEYMAP_SHIFT|KEYMAP_LETTER,      // K
+    0x0f|KEYMAP_SHIFT|KEYMAP_LETTER,      // L
+    0x10|KEYMAP_SHIFT|KEYMAP_LETTER,      // M
+    0x11|KEYMAP_SHIFT|KEYMAP_LETTER,      // N
+    0x12|KEYMAP_SHIFT|KEYMAP_LETTER,      // O
+    0x13|KEYMAP_SHIFT|KEYMAP_LETTER,      // P
+    0x14|KEYMAP_SHIFT|KEYMAP_LETTER,      // Q
+    0x15|KEYMAP_SHIFT|KEYMAP_LETTER,      // R
+    0x16|KEYMAP_SHIFT|KEYMAP_LETTER,      // S
+    0x17|KEYMAP_SHIFT|KEYMAP_LETTER,      // T
+    0x18|KEYMAP_SHIFT|KEYMAP_LETTER,      // U
+    0x19|KEYMAP_SHIFT|KEYMAP_LETTER,      // V
+    0x1a|KEYMAP_SHIFT|KEYMAP_LETTER,      // W
+    0x1b|KEYMAP_SHIFT|KEYMAP_LETTER,      // X
+    0x1c|KEYMAP_SHIFT|KEYMAP_LETTER,      // Y
+    0x1d|KEYMAP_SHIFT|KEYMAP_LETTER,      // Z
     0x2f,          // [
     0x31,          // bslash
     0x30,          // ]
-    0x23|SHIFT_KEY,    // ^
-    0x2d|SHIFT_KEY,    // _
+    0x23|KEYMAP_SHIFT,    // ^
+    0x2d|KEYMAP_SHIFT,    // _
     0x35,          // `
-    0x04,          // a
-    0x05,          // b
-    0x06,          // c
-    0x07,          // d
-    0x08,          // e
-    0x09,          // f
-    0x0a,          // g
-    0x0b,          // h
-    0x0c,          // i
-    0x0d,          // j
-    0x0e,          // k
-    0x0f,          // l
-    0x10,          // m
-    0x11,          // n
-    0x12,          // o
-    0x13,          // p
-    0x14,          // q
-    0x15,          // r
-    0x16,          // s
-    0x17,          // t
-    0x18,          // u
-    0x19,          // v
-    0x1a,          // w
-    0x1b,          // x
-    0x1c,          // y
-    0x1d,          // z
-    0x2f|SHIFT_KEY,    //
-    0x31|SHIFT_KEY,    // |
-    0x30|SHIFT_KEY,    // }
-    0x35|SHIFT_KEY,    // ~
-    0                                // DEL
+    0x04|KEYMAP_LETTER,          // a
+    0x05|KEYMAP_LETTER,          // b
+    0x06|KEYMAP_LETTER,          // c
+    0x07|KEYMAP_LETTER,          // d
+    0x08|KEYMAP_LETTER,          // e
+    0x09|KEYMAP_LETTER,          // f
+    0x0a|KEYMAP_LETTER,          // g
+    0x0b|KEYMAP_LETTER,          // h
+    0x0c|KEYMAP_LETTER,          // i
+    0x0d|KEYMAP_LETTER,          // j
+    0x0e|KEYMAP_LETTER,          // k
+    0x0f|KEYMAP_LETTER,          // l
+    0x10|KEYMAP_LETTER,          // m
+    0x11|KEYMAP_LETTER,          // n
+    0x12|KEYMAP_LETTER,          // o
+    0x13|KEYMAP_LETTER,          // p
+    0x14|KEYMAP_LETTER,          // q
+    0x15|KEYMAP_LETTER,          // r
+    0x16|KEYMAP_LETTER,          // s
+    0x17|KEYMAP_LETTER,          // t
+    0x18|KEYMAP_LETTER,          // u
+    0x19|KEYMAP_LETTER,          // v
+    0x1a|KEYMAP_LETTER,          // w
+    0x1b|KEYMAP_LETTER,          // x
+    0x1c|KEYMAP_LETTER,          // y
+    0x1d|KEYMAP_LETTER,          // z
+    0x2f|KEYMAP_SHIFT,    //
+    0x31|KEYMAP_SHIFT,    // |
+    0x30|KEYMAP_SHIFT,    // }
+    0x35|KEYMAP_SHIFT,    // ~
+    0,                               // DEL
+#elif HIDGENERIC_LAYOUT == HIDGENERIC_LAYOUT_DE
+    0x00,                             // NUL
+    0x00,                             // SOH
+    0x00,                             // STX
+    0x00,                             // ETX
+    0x00,                             // EOT
+    0x00,                             // ENQ
+    0x00,                             // ACK
+    0x00,                             // BEL
+    0x2a,                             // BS
+    0x2b,                             // TAB
+    0x28,                             // LF
+    0x00,                             // VT
+    0x00,                             // FF
+    0x00,                             // CR
+    0x00,                             // SO
+    0x00,                             // SI
+    0x00,                             // DEL
+    0x00,                             // DC1
+    0x00,                             // DC2
+    0x00,                             // DC3
+    0x00,                             // DC4
+    0x00,                             // NAK
+    0x00,                             // SYN
+    0x00,                             // ETB
+    0x00,                             // CAN
+    0x00,                             // EM
+    0x00,                             // SUB
+    0x00,                             // ESC
+    0x00,                             // FS
+    0x00,                             // GS
+    0x00,                             // RS
+    0x00,                             // US
+    0x2c,                             // ' '
+    0x1e|KEYMAP_SHIFT,                // !
+    0x1f|KEYMAP_SHIFT,                // "
+    0x32,                             // #
+    0x21|KEYMAP_SHIFT,                // $
+    0x22|KEYMAP_SHIFT,                // %
+    0x23|KEYMAP_SHIFT,                // &
+    0x32|KEYMAP_SHIFT,                // '
+    0x25|KEYMAP_SHIFT,                // (
+    0x26|KEYMAP_SHIFT,                // )
+    0x30|KEYMAP_SHIFT,                // *
+    0x30,                             // +
+    0x36,                             // ,
+    0x38,                             // -
+    0x37,                             // .
+    0x24|KEYMAP_SHIFT,                // /
+    0x27,                             // 0
+    0x1e,                             // 1
+    0x1f,                             // 2
+    0x20,                             // 3
+    0x21,                             // 4
+    0x22,                             // 5
+    0x23,                             // 6
+    0x24,                             // 7
+    0x25,                             // 8
+    0x26,                             // 9
+    0x37|KEYMAP_SHIFT,                // :
+    0x36|KEYMAP_SHIFT,                // ;
+    0x64,                             // <
+    0x27|KEYMAP_SHIFT,                // =
+    0x64|KEYMAP_SHIFT,                // >
+    0x2d|KEYMAP_SHIFT,                // ?
+    0x14|KEYMAP_ALTGR,                // @
+    0x04|KEYMAP_SHIFT|KEYMAP_LETTER,  // A
+    0x05|KEYMAP_SHIFT|KEYMAP_LETTER,  // B
+    0x06|KEYMAP_SHIFT|KEYMAP_LETTER,  // C
+    0x07|KEYMAP_SHIFT|KEYMAP_LETTER,  // D
+    0x08|KEYMAP_SHIFT|KEYMAP_LETTER,  // E
+    0x09|KEYMAP_SHIFT|KEYMAP_LETTER,  // F
+    0x0a|KEYMAP_SHIFT|KEYMAP_LETTER,  // G
+    0x0b|KEYMAP_SHIFT|KEYMAP_LETTER,  // H
+    0x0c|KEYMAP_SHIFT|KEYMAP_LETTER,  // I
+    0x0d|KEYMAP_SHIFT|KEYMAP_LETTER,  // J
+    0x0e|KEYMAP_SHIFT|KEYMAP_LETTER,  // K
+    0x0f|KEYMAP_SHIFT|KEYMAP_LETTER,  // L
+    0x10|KEYMAP_SHIFT|KEYMAP_LETTER,  // M
+    0x11|KEYMAP_SHIFT|KEYMAP_LETTER,  // N
+    0x12|KEYMAP_SHIFT|KEYMAP_LETTER,  // O
+    0x13|KEYMAP_SHIFT|KEYMAP_LETTER,  // P
+    0x14|KEYMAP_SHIFT|KEYMAP_LETTER,  // Q
+    0x15|KEYMAP_SHIFT|KEYMAP_LETTER,  // R
+    0x16|KEYMAP_SHIFT|KEYMAP_LETTER,  // S
+    0x17|KEYMAP_SHIFT|KEYMAP_LETTER,  // T
+    0x18|KEYMAP_SHIFT|KEYMAP_LETTER,  // U
+    0x19|KEYMAP_SHIFT|KEYMAP_LETTER,  // V
+    0x1a|KEYMAP_SHIFT|KEYMAP_LETTER,  // W
+    0x1b|KEYMAP_SHIFT|KEYMAP_LETTER,  // X
+    0x1d|KEYMAP_SHIFT|KEYMAP_LETTER,  // Y
+    0x1c|KEYMAP_SHIFT|KEYMAP_LETTER,  // Z
+    0x25|KEYMAP_ALTGR,                // [
+    0x2d|KEYMAP_ALTGR,                // bslash
+    0x26|KEYMAP_ALTGR,                // ]
+    0,                                // ^
+    0x38|KEYMAP_SHIFT,                // _
+    0,                                // `
+    0x04|KEYMAP_LETTER,               // a
+    0x05|KEYMAP_LETTER,               // b
+    0x06|KEYMAP_LETTER,               // c
+    0x07|KEYMAP_LETTER,               // d
+    0x08|KEYMAP_LETTER,               // e
+    0x09|KEYMAP_LETTER,               // f
+    0x0a|KEYMAP_LETTER,               // g
+    0x0b|KEYMAP_LETTER,               // h
+    0x0c|KEYMAP_LETTER,               // i
+    0x0d|KEYMAP_LETTER,               // j
+    0x0e|KEYMAP_LETTER,               // k
+    0x0f|KEYMAP_LETTER,               // l
+    0x10|KEYMAP_LETTER,               // m
+    0x11|KEYMAP_LETTER,               // n
+    0x12|KEYMAP_LETTER,               // o
+    0x13|KEYMAP_LETTER,               // p
+    0x14|KEYMAP_LETTER,               // q
+    0x15|KEYMAP_LETTER,               // r
+    0x16|KEYMAP_LETTER,               // s
+    0x17|KEYMAP_LETTER,               // t
+    0x18|KEYMAP_LETTER,               // u
+    0x19|KEYMAP_LETTER,               // v
+    0x1a|KEYMAP_LETTER,               // w
+    0x1b|KEYMAP_LETTER,               // x
+    0x1d|KEYMAP_LETTER,               // y
+    0x1c|KEYMAP_LETTER,               // z
+    0x24|KEYMAP_ALTGR,                // {
+    0x64|KEYMAP_ALTGR,                // |
+    0x27|KEYMAP_ALTGR,                // }
+    0x30|KEYMAP_ALTGR,                // ~
+    0,                                // DEL
+#elif HIDGENERIC_LAYOUT == HIDGENERIC_LAYOUT_FR
+    0x00,                             // NUL
+    0x00,                             // SOH
+    0x00,                             // STX
+    0x00,                             // ETX
+    0x00,                             // EOT
+    0x00,                             // ENQ
+    0x00,                             // ACK
+    0x00,                             // BEL
+    0x2a,                             // BS
+    0x2b,                             // TAB
+    0x28,                             // LF
+    0x00,                             // VT
+    0x00,                             // FF
+    0x00,                             // CR
+    0x00,                             // SO
+    0x00,                             // SI
+    0x00,                             // DEL
+    0x00,                             // DC1
+    0x00,                             // DC2
+    0x00,                             // DC3
+    0x00,                             // DC4
+    0x00,                             // NAK
+    0x00,                             // SYN
+    0x00,                             // ETB
+    0x00,                             // CAN
+    0x00,                             // EM
+    0x00,                             // SUB
+    0x00,                             // ESC
+    0x00,                             // FS
+    0x00,                             // GS
+    0x00,                             // RS
+    0x00,                             // US
+    0x2c,                             // ' '
+    0x38,                             // !
+    0x20|KEYMAP_LETTER,               // "
+    0x20|KEYMAP_ALTGR,                // #
+    0x30,                             // $
+    0x34|KEYMAP_SHIFT,                // %
+    0x1e|KEYMAP_LETTER,               // &
+    0x21|KEYMAP_LETTER,               // '
+    0x22|KEYMAP_LETTER,               // (
+    0x2d,                             // )
+    0x32,                             // *
+    0x2e|KEYMAP_SHIFT,                // +
+    0x10,                             // ,
+    0x23|KEYMAP_LETTER,               // -
+    0x36|KEYMAP_SHIFT,                // .
+    0x37|KEYMAP_SHIFT,                // /
+    0x27|KEYMAP_SHIFT|KEYMAP_LETTER,  // 0
+    0x1e|KEYMAP_SHIFT|KEYMAP_LETTER,  // 1
+    0x1f|KEYMAP_SHIFT|KEYMAP_LETTER,  // 2
+    0x20|KEYMAP_SHIFT|KEYMAP_LETTER,  // 3
+    0x21|KEYMAP_SHIFT|KEYMAP_LETTER,  // 4
+    0x22|KEYMAP_SHIFT|KEYMAP_LETTER,  // 5
+    0x23|KEYMAP_SHIFT|KEYMAP_LETTER,  // 6
+    0x24|KEYMAP_SHIFT|KEYMAP_LETTER,  // 7
+    0x25|KEYMAP_SHIFT|KEYMAP_LETTER,  // 8
+    0x26|KEYMAP_SHIFT|KEYMAP_LETTER,  // 9
+    0x37,                             // :
+    0x36,                             // ;
+    0x64,                             // <
+    0x2e,                             // =
+    0x64|KEYMAP_SHIFT,                // >
+    0x10|KEYMAP_SHIFT,                // ?
+    0x27|KEYMAP_ALTGR,                // @
+    0x14|KEYMAP_SHIFT|KEYMAP_LETTER,  // A
+    0x05|KEYMAP_SHIFT|KEYMAP_LETTER,  // B
+    0x06|KEYMAP_SHIFT|KEYMAP_LETTER,  // C
+    0x07|KEYMAP_SHIFT|KEYMAP_LETTER,  // D
+    0x08|KEYMAP_SHIFT|KEYMAP_LETTER,  // E
+    0x09|KEYMAP_SHIFT|KEYMAP_LETTER,  // F
+    0x0a|KEYMAP_SHIFT|KEYMAP_LETTER,  // G
+    0x0b|KEYMAP_SHIFT|KEYMAP_LETTER,  // H
+    0x0c|KEYMAP_SHIFT|KEYMAP_LETTER,  // I
+    0x0d|KEYMAP_SHIFT|KEYMAP_LETTER,  // J
+    0x0e|KEYMAP_SHIFT|KEYMAP_LETTER,  // K
+    0x0f|KEYMAP_SHIFT|KEYMAP_LETTER,  // L
+    0x33|KEYMAP_SHIFT|KEYMAP_LETTER,  // M
+    0x11|KEYMAP_SHIFT|KEYMAP_LETTER,  // N
+    0x12|KEYMAP_SHIFT|KEYMAP_LETTER,  // O
+    0x13|KEYMAP_SHIFT|KEYMAP_LETTER,  // P
+    0x04|KEYMAP_SHIFT|KEYMAP_LETTER,  // Q
+    0x15|KEYMAP_SHIFT|KEYMAP_LETTER,  // R
+    0x16|KEYMAP_SHIFT|KEYMAP_LETTER,  // S
+    0x17|KEYMAP_SHIFT|KEYMAP_LETTER,  // T
+    0x18|KEYMAP_SHIFT|KEYMAP_LETTER,  // U
+    0x19|KEYMAP_SHIFT|KEYMAP_LETTER,  // V
+    0x1d|KEYMAP_SHIFT|KEYMAP_LETTER,  // W
+    0x1b|KEYMAP_SHIFT|KEYMAP_LETTER,  // X
+    0x1c|KEYMAP_SHIFT|KEYMAP_LETTER,  // Y
+    0x1a|KEYMAP_SHIFT|KEYMAP_LETTER,  // Z
+    0x22|KEYMAP_ALTGR,                // [
+    0x25|KEYMAP_ALTGR,                // bslash
+    0x2d|KEYMAP_ALTGR,                // ]
+    0x26|KEYMAP_ALTGR,                // ^
+    0x25|KEYMAP_LETTER,               // _
+    0,                                // `
+    0x14|KEYMAP_LETTER,               // a
+    0x05|KEYMAP_LETTER,               // b
+    0x06|KEYMAP_LETTER,               // c
+    0x07|KEYMAP_LETTER,               // d
+    0x08|KEYMAP_LETTER,               // e
+    0x09|KEYMAP_LETTER,               // f
+    0x0a|KEYMAP_LETTER,               // g
+    0x0b|KEYMAP_LETTER,               // h
+    0x0c|KEYMAP_LETTER,               // i
+    0x0d|KEYMAP_LETTER,               // j
+    0x0e|KEYMAP_LETTER,               // k
+    0x0f|KEYMAP_LETTER,               // l
+    0x33|KEYMAP_LETTER,               // m
+    0x11|KEYMAP_LETTER,               // n
+    0x12|KEYMAP_LETTER,               // o
+    0x13|KEYMAP_LETTER,               // p
+    0x04|KEYMAP_LETTER,               // q
+    0x15|KEYMAP_LETTER,               // r
+    0x16|KEYMAP_LETTER,               // s
+    0x17|KEYMAP_LETTER,               // t
+    0x18|KEYMAP_LETTER,               // u
+    0x19|KEYMAP_LETTER,               // v
+    0x1d|KEYMAP_LETTER,               // w
+    0x1b|KEYMAP_LETTER,               // x
+    0x1c|KEYMAP_LETTER,               // y
+    0x1a|KEYMAP_LETTER,               // z
+    0x21|KEYMAP_ALTGR,                // {
+    0x23|KEYMAP_ALTGR,                // |
+    0x2e|KEYMAP_ALTGR,                // }
+    0,                                // ~
+    0,                                // DEL
+#else
+#error Unknown HIDGENERIC_LAYOUT
+#endif
+
+    KEYMAP_MODIFIER(0),     // KEYBOARD_LEFT_CTRL
+    KEYMAP_MODIFIER(1),     // KEYBOARD_LEFT_SHIFT
+    KEYMAP_MODIFIER(2),     // KEYBOARD_LEFT_ALT
+    KEYMAP_MODIFIER(3),     // KEYBOARD_LEFT_GUI
+    KEYMAP_MODIFIER(4),     // KEYBOARD_RIGHT_CTRL
+    KEYMAP_MODIFIER(5),     // KEYBOARD_RIGHT_SHIFT
+    KEYMAP_MODIFIER(6),     // KEYBOARD_RIGHT_ALT
+    KEYMAP_MODIFIER(7),     // KEYBOARD_RIGHT_GUI
+
+    KEYMAP_KEYS8(0x00), KEYMAP_KEYS8(0x08), KEYMAP_KEYS8(0x10),
+    KEYMAP_KEYS8(0x18), KEYMAP_KEYS8(0x20), KEYMAP_KEYS8(0x28),
+    KEYMAP_KEYS8(0x30), KEYMAP_KEYS8(0x38), KEYMAP_KEYS8(0x40),
+    KEYMAP_KEYS8(0x48), KEYMAP_KEYS8(0x50), KEYMAP_KEYS8(0x58),
+    KEYMAP_KEYS8(0x60), KEYMAP_KEYS8(0x68), KEYMAP_KEYS8(0x70)
+};
+
+
+// Layout tables for characters outside ASCII
+//
+// Entries give the key to press and, in bits 12-14, the dead key (if
+// any) that has to be typed first, numbered from 1 in layoutDeadKeys.
+// A character that is itself a dead key is typed as the dead key
+// followed by space. The Latin-1 supplement (U+00A0 - U+00FF) is a
+// straight table; the few characters elsewhere are in layoutExtras.
+// US has neither, so everything outside ASCII goes through the
+// Unicode entry method.
+#define LAYOUT_LETTER       0x0080       // affected by Caps Lock
+#define LAYOUT_SHIFT        0x0100       // left shift
+#define LAYOUT_ALTGR        0x0200       // right alt
+#define LAYOUT_DEAD(n)      ((n) << 12)
+#define LAYOUT_LATIN1_FIRST 0xa0
+
+#if HIDGENERIC_LAYOUT == HIDGENERIC_LAYOUT_DE
+#define LAYOUT_TABLES
+
+// Windows German (T1). Linux has AltGr + '+' as a dead tilde; here it
+// is the plain one, as on Windows.
+static const uint16_t layoutDeadKeys[] PROGMEM = {
+    0x35,                          // 1 ^
+    0x2e,                          // 2 acute
+    0x2e|LAYOUT_SHIFT,             // 3 `
+};
+
+static const uint16_t layoutLatin1[96] PROGMEM = {
+    0,                                                // A0 no-break space
+    0,                                                // A1 inverted exclamation mark
+    0,                                                // A2 cent sign
+    0,                                                // A3 pound sign
+    0,                                                // A4 currency sign
+    0,                                                // A5 yen sign
+    0,                                                // A6 broken bar
+    0x20|LAYOUT_SHIFT,                                // A7 section sign
+    0,                                                // A8 diaeresis
+    0,                                                // A9 copyright sign
+    0,                                                // AA feminine ordinal indicator
+    0,                                                // AB left guillemet
+    0,                                                // AC not sign
+    0,                                                // AD soft hyphen
+    0,                                                // AE registered sign
+    0,                                                // AF macron
+    0x35|LAYOUT_SHIFT,                                // B0 degree sign
+    0,                                                // B1 plus-minus sign
+    0x1f|LAYOUT_ALTGR,                                // B2 superscript two
+    0x20|LAYOUT_ALTGR,                                // B3 superscript three
+    LAYOUT_DEAD(2)|0x2c,                              // B4 acute accent
+    0x10|LAYOUT_ALTGR,                                // B5 micro sign
+    0,                                                // B6 pilcrow sign
+    0,                                                // B7 middle dot
+    0,                                                // B8 cedilla
+    0,                                                // B9 superscript one
+    0,                                                // BA masculine ordinal indicator
+    0,                                                // BB right guillemet
+    0,                                                // BC vulgar fraction one quarter
+    0,                                                // BD vulgar fraction one half
+    0,                                                // BE vulgar fraction three quarters
+    0,                                                // BF inverted question mark
+    LAYOUT_DEAD(3)|0x04|LAYOUT_SHIFT|LAYOUT_LETTER,   // C0 cap a grave
+    LAYOUT_DEAD(2)|0x04|LAYOUT_SHIFT|LAYOUT_LETTER,   // C1 cap a acute
+    LAYOUT_DEAD(1)|0x04|LAYOUT_SHIFT|LAYOUT_LETTER,   // C2 cap a circumflex
+    0,                                                // C3 cap a tilde
+    0x34|LAYOUT_SHIFT|LAYOUT_LETTER,                  // C4 cap a diaeresis
+    0,                                                // C5 cap a ring above
+    0,                                                // C6 cap ae
+    0,                                                // C7 cap c cedilla
+    LAYOUT_DEAD(3)|0x08|LAYOUT_SHIFT|LAYOUT_LETTER,   // C8 cap e grave
+    LAYOUT_DEAD(2)|0x08|LAYOUT_SHIFT|LAYOUT_LETTER,   // C9 cap e acute
+    LAYOUT_DEAD(1)|0x08|LAYOUT_SHIFT|LAYOUT_LETTER,   // CA cap e circumflex
+    0,                                                // CB cap e diaeresis
+    LAYOUT_DEAD(3)|0x0c|LAYOUT_SHIFT|LAYOUT_LETTER,   // CC cap i grave
+    LAYOUT_DEAD(2)|0x0c|LAYOUT_SHIFT|LAYOUT_LETTER,   // CD cap i acute
+    LAYOUT_DEAD(1)|0x0c|LAYOUT_SHIFT|LAYOUT_LETTER,   // CE cap i circumflex
+    0,                                                // CF cap i diaeresis
+    0,                                                // D0 cap eth
+    0,                                                // D1 cap n tilde
+    LAYOUT_DEAD(3)|0x12|LAYOUT_SHIFT|LAYOUT_LETTER,   // D2 cap o grave
+    LAYOUT_DEAD(2)|0x12|LAYOUT_SHIFT|LAYOUT_LETTER,   // D3 cap o acute
+    LAYOUT_DEAD(1)|0x12|LAYOUT_SHIFT|LAYOUT_LETTER,   // D4 cap o circumflex
+    0,                                                // D5 cap o tilde
+    0x33|LAYOUT_SHIFT|LAYOUT_LETTER,                  // D6 cap o diaeresis
+    0,                                                // D7 multiplication sign
+    0,                                                // D8 cap o stroke
+    LAYOUT_DEAD(3)|0x18|LAYOUT_SHIFT|LAYOUT_LETTER,   // D9 cap u grave
+    LAYOUT_DEAD(2)|0x18|LAYOUT_SHIFT|LAYOUT_LETTER,   // DA cap u acute
+    LAYOUT_DEAD(1)|0x18|LAYOUT_SHIFT|LAYOUT_LETTER,   // DB cap u circumflex
+    0x2f|LAYOUT_SHIFT|LAYOUT_LETTER,                  // DC cap u diaeresis
+    LAYOUT_DEAD(2)|0x1d|LAYOUT_SHIFT|LAYOUT_LETTER,   // DD cap y acute
+    0,                                                // DE cap thorn
+    0x2d,                                             // DF sharp s
+    LAYOUT_DEAD(3)|0x04|LAYOUT_LETTER,                // E0 a grave
+    LAYOUT_DEAD(2)|0x04|LAYOUT_LETTER,                // E1 a acute
+    LAYOUT_DEAD(1)|0x04|LAYOUT_LETTER,                // E2 a circumflex
+    0,                                                // E3 a tilde
+    0x34|LAYOUT_LETTER,                               // E4 a diaeresis
+    0,                                                // E5 a ring above
+    0,                                                // E6 ae
+    0,                                                // E7 c cedilla
+    LAYOUT_DEAD(3)|0x08|LAYOUT_LETTER,                // E8 e grave
+    LAYOUT_DEAD(2)|0x08|LAYOUT_LETTER,                // E9 e acute
+    LAYOUT_DEAD(1)|0x08|LAYOUT_LETTER,                // EA e circumflex
+    0,                                                // EB e diaeresis
+    LAYOUT_DEAD(3)|0x0c|LAYOUT_LETTER,                // EC i grave
+    LAYOUT_DEAD(2)|0x0c|LAYOUT_LETTER,                // ED i acute
+    LAYOUT_DEAD(1)|0x0c|LAYOUT_LETTER,                // EE i circumflex
+    0,                                                // EF i diaeresis
+    0,                                                // F0 eth
+    0,                                                // F1 n tilde
+    LAYOUT_DEAD(3)|0x12|LAYOUT_LETTER,                // F2 o grave
+    LAYOUT_DEAD(2)|0x12|LAYOUT_LETTER,                // F3 o acute
+    LAYOUT_DEAD(1)|0x12|LAYOUT_LETTER,                // F4 o circumflex
+    0,                                                // F5 o tilde
+    0x33|LAYOUT_LETTER,                               // F6 o diaeresis
+    0,                                                // F7 division sign
+    0,                                                // F8 o stroke
+    LAYOUT_DEAD(3)|0x18|LAYOUT_LETTER,                // F9 u grave
+    LAYOUT_DEAD(2)|0x18|LAYOUT_LETTER,                // FA u acute
+    LAYOUT_DEAD(1)|0x18|LAYOUT_LETTER,                // FB u circumflex
+    0x2f|LAYOUT_LETTER,                               // FC u diaeresis
+    LAYOUT_DEAD(2)|0x1d|LAYOUT_LETTER,                // FD y acute
+    0,                                                // FE thorn
+    0,                                                // FF y diaeresis
+};
+
+static const uint16_t layoutExtras[][2] PROGMEM = {
+    { 0x005e, LAYOUT_DEAD(1)|0x2c },          // ^
+    { 0x0060, LAYOUT_DEAD(3)|0x2c },          // `
+    { 0x20ac, 0x08|LAYOUT_ALTGR },            // euro sign
+};
+
+#elif HIDGENERIC_LAYOUT == HIDGENERIC_LAYOUT_FR
+#define LAYOUT_TABLES
+
+// Windows French (AZERTY). Caps Lock acts as shift on the number row,
+// so those keys carry LAYOUT_LETTER (KEYMAP_LETTER in the keymap).
+static const uint16_t layoutDeadKeys[] PROGMEM = {
+    0x2f,                          // 1 ^
+    0x2f|LAYOUT_SHIFT,             // 2 diaeresis
+    0x1f|LAYOUT_ALTGR,             // 3 ~
+    0x24|LAYOUT_ALTGR,             // 4 `
 };
 
+static const uint16_t layoutLatin1[96] PROGMEM = {
+    0,                                                // A0 no-break space
+    0,                                                // A1 inverted exclamation mark
+    0,                                                // A2 cent sign
+    0x30|LAYOUT_SHIFT,                                // A3 pound sign
+    0x30|LAYOUT_ALTGR,                                // A4 currency sign
+    0,                                                // A5 yen sign
+    0,                                                // A6 broken bar
+    0x38|LAYOUT_SHIFT,                                // A7 section sign
+    LAYOUT_DEAD(2)|0x2c,                              // A8 diaeresis
+    0,                                                // A9 copyright sign
+    0,                                                // AA feminine ordinal indicator
+    0,                                                // AB left guillemet
+    0,                                                // AC not sign
+    0,                                                // AD soft hyphen
+    0,                                                // AE registered sign
+    0,                                                // AF macron
+    0x2d|LAYOUT_SHIFT,                                // B0 degree sign
+    0,                                                // B1 plus-minus sign
+    0x35,                                             // B2 superscript two
+    0,                                                // B3 superscript three
+    0,                                                // B4 acute accent
+    0x32|LAYOUT_SHIFT,                                // B5 micro sign
+    0,                                                // B6 pilcrow sign
+    0,                                                // B7 middle dot
+    0,                                                // B8 cedilla
+    0,                                                // B9 superscript one
+    0,                                                // BA masculine ordinal indicator
+    0,                                                // BB right guillemet
+    0,                                                // BC vulgar fraction one quarter
+    0,                                                // BD vulgar fraction one half
+    0,                                                // BE vulgar fraction three quarters
+    0,                                                // BF inverted question mark
+    LAYOUT_DEAD(4)|0x14|LAYOUT_SHIFT|LAYOUT_LETTER,   // C0 cap a grave
+    0,                                                // C1 cap a acute
+    LAYOUT_DEAD(1)|0x14|LAYOUT_SHIFT|LAYOUT_LETTER,   // C2 cap a circumflex
+    LAYOUT_DEAD(3)|0x14|LAYOUT_SHIFT|LAYOUT_LETTER,   // C3 cap a tilde
+    LAYOUT_DEAD(2)|0x14|LAYOUT_SHIFT|LAYOUT_LETTER,   // C4 cap a diaeresis
+    0,                                                // C5 cap a ring above
+    0,                                                // C6 cap ae
+    0,                                                // C7 cap c cedilla
+    LAYOUT_DEAD(4)|0x08|LAYOUT_SHIFT|LAYOUT_LETTER,   // C8 cap e grave
+    0,                                                // C9 cap e acute
+    LAYOUT_DEAD(1)|0x08|LAYOUT_SHIFT|LAYOUT_LETTER,   // CA cap e circumflex
+    LAYOUT_DEAD(2)|0x08|LAYOUT_SHIFT|LAYOUT_LETTER,   // CB cap e diaeresis
+    LAYOUT_DEAD(4)|0x0c|LAYOUT_SHIFT|LAYOUT_LETTER,   // CC cap i grave
+    0,                                                // CD cap i acute
+    LAYOUT_DEAD(1)|0x0c|LAYOUT_SHIFT|LAYOUT_LETTER,   // CE cap i circumflex
+    LAYOUT_DEAD(2)|0x0c|LAYOUT_SHIFT|LAYOUT_LETTER,   // CF cap i diaeresis
+    0,                                                // D0 cap eth
+    LAYOUT_DEAD(3)|0x11|LAYOUT_SHIFT|LAYOUT_LETTER,   // D1 cap n tilde
+    LAYOUT_DEAD(4)|0x12|LAYOUT_SHIFT|LAYOUT_LETTER,   // D2 cap o grave
+    0,                                                // D3 cap o acute
+    LAYOUT_DEAD(1)|0x12|LAYOUT_SHIFT|LAYOUT_LETTER,   // D4 cap o circumflex
+    LAYOUT_DEAD(3)|0x12|LAYOUT_SHIFT|LAYOUT_LETTER,   // D5 cap o tilde
+    LAYOUT_DEAD(2)|0x12|LAYOUT_SHIFT|LAYOUT_LETTER,   // D6 cap o diaeresis
+    0,                                                // D7 multiplication sign
+    0,                                                // D8 cap o stroke
+    LAYOUT_DEAD(4)|0x18|LAYOUT_SHIFT|LAYOUT_LETTER,   // D9 cap u grave
+    0,                                                // DA cap u acute
+    LAYOUT_DEAD(1)|0x18|LAYOUT_SHIFT|LAYOUT_LETTER,   // DB cap u circumflex
+    LAYOUT_DEAD(2)|0x18|LAYOUT_SHIFT|LAYOUT_LETTER,   // DC cap u diaeresis
+    0,                                                // DD cap y acute
+    0,                                                // DE cap thorn
+    0,                                                // DF sharp s
+    0x27|LAYOUT_LETTER,                               // E0 a grave
+    0,                                                // E1 a acute
+    LAYOUT_DEAD(1)|0x14|LAYOUT_LETTER,                // E2 a circumflex
+    LAYOUT_DEAD(3)|0x14|LAYOUT_LETTER,                // E3 a tilde
+    LAYOUT_DEAD(2)|0x14|LAYOUT_LETTER,                // E4 a diaeresis
+    0,                                                // E5 a ring above
+    0,                                                // E6 ae
+    0x26|LAYOUT_LETTER,                               // E7 c cedilla
+    0x24|LAYOUT_LETTER,                               // E8 e grave
+    0x1f|LAYOUT_LETTER,                               // E9 e acute
+    LAYOUT_DEAD(1)|0x08|LAYOUT_LETTER,                // EA e circumflex
+    LAYOUT_DEAD(2)|0x08|LAYOUT_LETTER,                // EB e diaeresis
+    LAYOUT_DEAD(4)|0x0c|LAYOUT_LETTER,                // EC i grave
+    0,                                                // ED i acute
+    LAYOUT_DEAD(1)|0x0c|LAYOUT_LETTER,                // EE i circumflex
+    LAYOUT_DEAD(2)|0x0c|LAYOUT_LETTER,                // EF i diaeresis
+    0,                                                // F0 eth
+    LAYOUT_DEAD(3)|0x11|LAYOUT_LETTER,                // F1 n tilde
+    LAYOUT_DEAD(4)|0x12|LAYOUT_LETTER,                // F2 o grave
+    0,                                                // F3 o acute
+    LAYOUT_DEAD(1)|0x12|LAYOUT_LETTER,                // F4 o circumflex
+    LAYOUT_DEAD(3)|0x12|LAYOUT_LETTER,                // F5 o tilde
+    LAYOUT_DEAD(2)|0x12|LAYOUT_LETTER,                // F6 o diaeresis
+    0,                                                // F7 division sign
+    0,                                                // F8 o stroke
+    0x34,                                             // F9 u grave
+    0,                                                // FA u acute
+    LAYOUT_DEAD(1)|0x18|LAYOUT_LETTER,                // FB u circumflex
+    LAYOUT_DEAD(2)|0x18|LAYOUT_LETTER,                // FC u diaeresis
+    0,                                                // FD y acute
+    0,                                                // FE thorn
+    LAYOUT_DEAD(2)|0x1c|LAYOUT_LETTER,                // FF y diaeresis
+};
+
+static const uint16_t layoutExtras[][2] PROGMEM = {
+    { 0x0060, LAYOUT_DEAD(4)|0x2c },          // `
+    { 0x007e, LAYOUT_DEAD(3)|0x2c },          // ~
+    { 0x20ac, 0x08|LAYOUT_ALTGR },            // euro sign
+};
+
+#endif
+
+
+// lookup() returns the keymap entry for k. For letters the Caps Lock
+// LED flips SHIFT without a branch: the letter flag (bit 7) shifted down
+// by 6 lands on bit 1, which is both LED_CAPS_LOCK and the left shift
+// bit of the modifier byte.
+uint16_t HIDGenericImpl::Keyboard::lookup(uint8_t k)
+{
+    typedef char caps_shift_check[
+        LED_CAPS_LOCK == (KEYMAP_LETTER >> 6) &&
+        LED_CAPS_LOCK == (KEYMAP_SHIFT >> 8) ? 1 : -1];
+    (void)sizeof(caps_shift_check);
+
+    uint16_t entry = pgm_read_word(&keymap[k]);
+    return entry ^ ((uint16_t)((entry >> 6) & leds_m & LED_CAPS_LOCK) << 8);
+}
+
+// Returns the slot holding k (the first free one for k == 0), or -1
+int8_t HIDGenericImpl::Keyboard::findKey(uint8_t k)
+{
+    for (int8_t i = 0; i < 6; i++) {
+        if (keys_m.keys[i] == k) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Add k to the key report only if it's not already present
+// and if there is an empty slot.
+bool HIDGenericImpl::Keyboard::addKey(uint8_t k)
+{
+    if (findKey(k) >= 0) {
+        return true;
+    }
+    int8_t i = findKey(0);
+    if (i < 0) {
+        return false;
+    }
+    keys_m.keys[i] = k;
+    return true;
+}
+
+// Clear k from the key report. Check all positions in case the key is
+// present more than once (which it shouldn't be)
+void HIDGenericImpl::Keyboard::removeKey(uint8_t k)
+{
+    int8_t i;
+    while (k && (i = findKey(k)) >= 0) {
+        keys_m.keys[i] = 0x00;
+    }
+}
 
 // press() adds the specified key (printing, non-printing, or modifier)
 // to the persistent key report and sends the report.  Because of the way
 // USB HID works, the host acts like the key remains pressed until we
 // call release(), releaseAll(), or otherwise clear the report and resend.
-size_t HIDGenericImpl::Keyboard::press(uint8_t k)
-{
-    uint8_t i;
-    if (k >= 136) {                        // it's a non-printing key (not a modifier)
-        k = k - 136;
-    } else if (k >= 128) {        // it's a modifier key
-        keys_m.modifiers |= (1<<(k-128));
-        k = 0;
-    } else {                                // it's a printing key
-        k = asciimap[k];
-        if (!k) {
-//            setWriteError();
-            return 0;
-        }
-        if (k & 0x80) {                                                // it's a capital letter or other character reached with shift
-            keys_m.modifiers |= 0x02;        // the left shift modifier
-            k &= 0x7F;
-        }
-    }
+// This is the key itself - Caps Lock is left to the host, as with a real
+// keyboard. The text paths go through pressText() instead.
+size_t HIDGenericImpl::Keyboard::press(HIDGenericImpl& hid, uint8_t k)
+{
+    return pressEntry(hid, pgm_read_word(&keymap[k]));
+}
 
-    // Add k to the key report only if it's not already present
-    // and if there is an empty slot.
-    if (keys_m.keys[0] != k && keys_m.keys[1] != k &&
-        keys_m.keys[2] != k && keys_m.keys[3] != k &&
-        keys_m.keys[4] != k && keys_m.keys[5] != k) {
+// Press for typing a character, with the shift of letters flipped to
+// suit the host's Caps Lock state
+size_t HIDGenericImpl::Keyboard::pressText(HIDGenericImpl& hid, uint8_t k)
+{
+    return pressEntry(hid, lookup(k));
+}
 
-        for (i=0; i<6; i++) {
-            if (keys_m.keys[i] == 0x00) {
-                keys_m.keys[i] = k;
-                break;
-            }
-        }
-        if (i == 6) {
-//            setWriteError();
-            return 0;
-        }
+// Modifiers that come with a key (the shift of 'A') are noted as added
+// by us, unless the application already holds them, so that release()
+// only takes away what press() put there. Pressing a modifier key
+// makes it the application's.
+size_t HIDGenericImpl::Keyboard::pressEntry(HIDGenericImpl& hid, uint16_t entry)
+{
+    uint8_t usage = entry & 0x7f;
+    uint8_t mods  = entry >> 8;
+
+    if (!entry || (usage && !addKey(usage))) {
+//        setWriteError();
+        return 0;
     }
-    sendReport(&keys_m);
+    if (usage) {
+        addedModifiers_m |= mods & ~keys_m.modifiers;
+    }
+    else {
+        addedModifiers_m &= ~mods;
+    }
+    keys_m.modifiers |= mods;
+    sendReport(hid);
     return 1;
 }
 
 // release() takes the specified key out of the persistent key report and
 // sends the report.  This tells the OS the key is no longer pressed and that
 // it shouldn't be repeated any more.
-size_t HIDGenericImpl::Keyboard::release(uint8_t k)
-{
-    uint8_t i;
-    if (k >= 136) {                        // it's a non-printing key (not a modifier)
-        k = k - 136;
-    } else if (k >= 128) {        // it's a modifier key
-        keys_m.modifiers &= ~(1<<(k-128));
-        k = 0;
-    } else {                                // it's a printing key
-        k = asciimap[k];
-        if (!k) {
-            return 0;
-        }
-        if (k & 0x80) {                                                        // it's a capital letter or other character reached with shift
-            keys_m.modifiers &= ~(0x02);        // the left shift modifier
-            k &= 0x7F;
-        }
+size_t HIDGenericImpl::Keyboard::release(HIDGenericImpl& hid, uint8_t k)
+{
+    uint16_t entry = pgm_read_word(&keymap[k]);
+    uint8_t  usage = entry & 0x7f;
+    uint8_t  mods  = entry >> 8;
+
+    if (!entry) {
+        return 0;
     }
 
-    // Test the key report to see if k is present.  Clear it if it exists.
-    // Check all positions in case the key is present more than once (which it shouldn't be)
-    for (i=0; i<6; i++) {
-        if (0 != k && keys_m.keys[i] == k) {
-            keys_m.keys[i] = 0x00;
-        }
+    if (usage) {
+        // A letter may have been typed with shift under a different
+        // Caps Lock state. Either way only shift that press() added
+        // goes.
+        mods = (mods | ((entry >> 6) & LED_CAPS_LOCK)) & addedModifiers_m;
+        removeKey(usage);
     }
+    keys_m.modifiers &= ~mods;
+    addedModifiers_m &= ~mods;
 
-    sendReport(&keys_m);
+    sendReport(hid);
     return 1;
 }
 
-void HIDGenericImpl::Keyboard::releaseAll(void)
+void HIDGenericImpl::Keyboard::releaseAll(HIDGenericImpl& hid)
 {
     keys_m.keys[0] = 0;
     keys_m.keys[1] = 0;
@@ -566,19 +1663,695 @@ void HIDGenericImpl::Keyboard::releaseAll(void)
     keys_m.keys[4] = 0;
     keys_m.keys[5] = 0;
     keys_m.modifiers = 0;
-    sendReport(&keys_m);
+    addedModifiers_m = 0;
+    sendReport(hid);
 }
 
-size_t HIDGenericImpl::Keyboard::write(uint8_t c)
+size_t HIDGenericImpl::Keyboard::write(HIDGenericImpl& hid, uint8_t c)
 {
     uint8_t p = 0;
 
-    Serial.print("Sending character: ");
-    Serial.println(c);
-    p = press(c);        // Keydown
-    release(c);                // Keyup
+    DEBUG_PRINT("Sending character: ");
+    DEBUG_PRINTLN(c);
+    p = pressText(hid, c);    // Keydown
+    release(hid, c);                // Keyup
 
     return (p);                // Just return the result of press() since release() almost always returns 1
 }
 
+// Bulk typing
+//
+// Rather than a full press/release pair per character, the key is only
+// released on its own when the next character needs the same key or a
+// different SHIFT state. Otherwise the report goes straight from one key
+// to the next, which the host sees as the old key going up and the new
+// one going down.
+size_t HIDGenericImpl::Keyboard::write(HIDGenericImpl& hid, const uint8_t* buffer, size_t size)
+{
+    uint8_t base = keys_m.modifiers;  // modifiers held by the application
+    uint8_t last = 0;                 // key this call left pressed
+    size_t  n    = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        uint8_t c = buffer[i];
+        uint16_t entry = lookup(c);
+        uint8_t k = entry & 0x7f;
+
+        if (c >= 128 || !k) {
+            // Non-printing keys and modifiers go through the normal path
+            if (last) {
+                removeKey(last);
+                keys_m.modifiers = base;
+                sendReport(hid);
+                last = 0;
+            }
+            n += write(hid, c);
+            continue;
+        }
+
+        uint8_t mods = (base & ~0x02) | (entry >> 8);
+        if (last) {
+            removeKey(last);
+            if (last == k || mods != keys_m.modifiers) {
+                keys_m.modifiers = mods;
+                sendReport(hid);
+            }
+        }
+        keys_m.modifiers = mods;
+        if (!addKey(k)) {
+            last = 0;
+            continue;
+        }
+        sendReport(hid);
+        last = k;
+        n++;
+    }
+
+    if (last) {
+        removeKey(last);
+        keys_m.modifiers = base;
+        sendReport(hid);
+    }
+    return n;
+}
+
+bool HIDGenericImpl::Keyboard::setLock(HIDGenericImpl& hid, uint8_t led, uint8_t key, bool on)
+{
+    if (((leds_m & led) != 0) == on) {
+        return false;
+    }
+    write(hid, key);
+
+    // Assume the host follows - its next output report will correct
+    // this if it doesn't
+    leds_m ^= led;
+    return true;
+}
+
+// Typing rate governor
+//
+// Every TYPING_STREAK keystrokes without a reported drop the gap moves
+// a quarter of the way down towards the last gap that failed (or the
+// minimum). A drop puts it back up by half plus TYPING_STEP. The failed
+// gap itself creeps down each time, so a host that has got faster is
+// found again.
+#define TYPING_STREAK  32
+#define TYPING_STEP    1000UL
+
+void HIDGenericImpl::Keyboard::setTypingProfile(uint8_t profile)
+{
+    switch (profile) {
+    case TYPING_USB:
+        setTypingGap(0, 0, 10000);
+        break;
+    case TYPING_BLUETOOTH:
+        setTypingGap(4000, 2000, 100000);
+        break;
+    case TYPING_SLOW_HOST:
+        setTypingGap(15000, 10000, 100000);
+        break;
+    default:
+        setTypingGap(1000, 0, 100000);
+        break;
+    }
+}
+
+void HIDGenericImpl::Keyboard::setTypingGap(uint32_t start, uint32_t min, uint32_t max)
+{
+    minGap_m    = min;
+    maxGap_m    = max > min ? max : min;
+    gap_m       = start < minGap_m ? minGap_m : start > maxGap_m ? maxGap_m : start;
+    failedGap_m = 0;
+    streak_m    = 0;
+}
+
+void HIDGenericImpl::Keyboard::reportTypingDrop(void)
+{
+    failedGap_m = gap_m;
+    gap_m += gap_m / 2 + TYPING_STEP;
+    if (gap_m > maxGap_m) {
+        gap_m = maxGap_m;
+    }
+    streak_m = 0;
+}
+
+uint16_t HIDGenericImpl::Keyboard::getTypingRate(void)
+{
+    uint32_t ms = typingTime_m / 1000;
+
+    if (!ms) {
+        return 0;
+    }
+    return typedChars_m * 1000 / ms;
+}
+
+void HIDGenericImpl::Keyboard::resetTypingRate(void)
+{
+    typingTime_m = 0;
+    typedChars_m = 0;
+}
+
+size_t HIDGenericImpl::Keyboard::type(const uint8_t* buffer, size_t size)
+{
+    size_t n;
+
+    for (n = 0; n < size; n++) {
+        uint8_t next = (typeHead_m + 1) & TYPE_AHEAD_MASK;
+        if (next == typeTail_m) {
+            break;
+        }
+        typeAhead_m[typeHead_m] = buffer[n];
+        typeHead_m = next;
+    }
+    return n;
+}
+
+// Send the next report of paced typing if its gap is up. A keystroke
+// is two reports - the press and then the release.
+void HIDGenericImpl::Keyboard::poll(HIDGenericImpl& hid)
+{
+    if (!isTyping()) {
+        return;
+    }
+
+    uint32_t now = micros();
+    if (now - lastTyped_m < gap_m) {
+        return;
+    }
+
+    if (typed_m) {
+        release(hid, typed_m);
+
+        // A keystroke takes from its press until the next press is
+        // allowed, so waiting for more to type doesn't count
+        typingTime_m += now - lastTyped_m + gap_m;
+        typedChars_m++;
+        typed_m = 0;
+        lastTyped_m = now;
+
+        if (++streak_m >= TYPING_STREAK) {
+            uint32_t floor = failedGap_m > minGap_m ? failedGap_m : minGap_m;
+            streak_m = 0;
+            if (gap_m > floor) {
+                gap_m -= (gap_m - floor + 3) / 4;
+            }
+            failedGap_m -= failedGap_m / 64;
+        }
+        return;
+    }
+
+    // Characters with nothing to send are skipped
+    while (typeHead_m != typeTail_m) {
+        uint8_t c = typeAhead_m[typeTail_m];
+        typeTail_m = (typeTail_m + 1) & TYPE_AHEAD_MASK;
+        if (pressText(hid, c)) {
+            typed_m = c;
+            lastTyped_m = now;
+            return;
+        }
+    }
+}
+
+// Press and release one key with the given modifiers in place of
+// the shift and AltGr the application may be holding
+void HIDGenericImpl::Keyboard::tap(HIDGenericImpl& hid, uint8_t usage, uint8_t modifiers)
+{
+    uint8_t base = keys_m.modifiers;
+
+    keys_m.modifiers = (base & ~(KEYMAP_SHIFT >> 8) & ~(KEYMAP_ALTGR >> 8)) | modifiers;
+    if (usage && addKey(usage)) {
+        sendReport(hid);
+        removeKey(usage);
+    }
+    else if (modifiers) {
+        sendReport(hid);
+    }
+    keys_m.modifiers = base;
+    sendReport(hid);
+}
+
+#ifdef LAYOUT_TABLES
+// Type a layout table entry, dead key first
+void HIDGenericImpl::Keyboard::tapStroke(HIDGenericImpl& hid, uint16_t stroke)
+{
+    uint8_t dead = (stroke >> 12) & 0x07;
+
+    if (dead) {
+        tapStroke(hid, pgm_read_word(&layoutDeadKeys[dead - 1]));
+    }
+
+    // Shift and AltGr move to their modifier bits, and Caps Lock flips
+    // the shift of letters as in lookup()
+    uint8_t mods = ((stroke >> 7) & (KEYMAP_SHIFT >> 8)) |
+                   ((stroke >> 3) & (KEYMAP_ALTGR >> 8));
+    mods ^= (stroke >> 6) & leds_m & LED_CAPS_LOCK;
+    tap(hid, stroke & 0x7f, mods);
+}
+#endif
+
+// Key for a hex digit of a Unicode entry sequence, in keymap form
+uint16_t HIDGenericImpl::Keyboard::hexKey(uint8_t digit)
+{
+    if (unicodeMethod_m == UNICODE_WINDOWS && digit < 10) {
+        // Keypad digits, whatever the layout
+        return digit ? 0x59 + digit - 1 : 0x62;
+    }
+    if (unicodeMethod_m == UNICODE_MACOS) {
+        // Unicode Hex Input is always laid out as US
+        return digit < 10 ? (digit ? 0x1e + digit - 1 : 0x27) : 0x04 + digit - 10;
+    }
+    return lookup(digit < 10 ? '0' + digit : 'a' + digit - 10);
+}
+
+// Enter c as hex with the host's Unicode input method
+size_t HIDGenericImpl::Keyboard::writeUnicode(HIDGenericImpl& hid, uint32_t c)
+{
+    uint8_t  hold;
+    uint8_t  digits = 4;
+    uint32_t units[2];
+    uint8_t  count = 1;
+
+    units[0] = c;
+    switch (unicodeMethod_m) {
+    case UNICODE_LINUX:
+        // Left ctrl and shift with U starts the entry
+        tap(hid, 0x18, 0x03);
+        hold = 0;
+        while (digits < 6 && (c >> (digits * 4))) {
+            digits++;
+        }
+        break;
+    case UNICODE_WINDOWS:
+        hold = 0x04;
+        while (digits < 6 && (c >> (digits * 4))) {
+            digits++;
+        }
+        break;
+    case UNICODE_MACOS:
+        // Four digits only - above the BMP it takes a surrogate pair
+        hold = 0x04;
+        if (c > 0xffff) {
+            units[0] = 0xd800 + ((c - 0x10000) >> 10);
+            units[1] = 0xdc00 + (c & 0x3ff);
+            count = 2;
+        }
+        break;
+    default:
+        return 0;
+    }
+
+    // Alt (Option) goes down first and is held through the whole
+    // sequence
+    uint8_t base = keys_m.modifiers;
+    if (hold) {
+        keys_m.modifiers |= hold;
+        sendReport(hid);
+    }
+    if (unicodeMethod_m == UNICODE_WINDOWS) {
+        tap(hid, 0x57, hold);                  // keypad +
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        for (int8_t d = digits - 1; d >= 0; d--) {
+            uint16_t key = hexKey((units[i] >> (d * 4)) & 0x0f);
+            tap(hid, key & 0x7f, (key >> 8) | hold);
+        }
+    }
+    if (hold) {
+        keys_m.modifiers = base;
+        sendReport(hid);
+    }
+
+    if (unicodeMethod_m == UNICODE_LINUX) {
+        tap(hid, 0x2c, 0);                     // space ends the entry
+    }
+    return 1;
+}
+
+// Type one Unicode character. ASCII goes through the keymap as write()
+// would; the rest uses the layout tables and then the Unicode entry
+// method. Returns 0 if there was no way to type it.
+size_t HIDGenericImpl::Keyboard::writeCodepoint(HIDGenericImpl& hid, uint32_t c)
+{
+    if (c < 0x80 && pgm_read_word(&keymap[c])) {
+        return write(hid, (uint8_t)c);
+    }
+
+#ifdef LAYOUT_TABLES
+    uint16_t stroke = 0;
+
+    if (c >= LAYOUT_LATIN1_FIRST && c <= 0xff) {
+        stroke = pgm_read_word(&layoutLatin1[c - LAYOUT_LATIN1_FIRST]);
+    }
+    else {
+        for (uint8_t i = 0; i < sizeof(layoutExtras) / sizeof(layoutExtras[0]); i++) {
+            if (pgm_read_word(&layoutExtras[i][0]) == c) {
+                stroke = pgm_read_word(&layoutExtras[i][1]);
+                break;
+            }
+        }
+    }
+    if (stroke) {
+        tapStroke(hid, stroke);
+        return 1;
+    }
+#endif
+
+    // Control characters without a key have no Unicode entry either
+    if (c < 0x20 || (c >= 0x7f && c < 0xa0)) {
+        return 0;
+    }
+    return writeUnicode(hid, c);
+}
+
+// Decode UTF-8 and type each character. A sequence may be split across
+// calls. Malformed sequences are skipped, and so are the forms UTF-8
+// doesn't allow: overlong encodings, surrogates (U+D800-DFFF) and
+// anything above U+10FFFF. These are caught by narrowing the range of
+// the first continuation byte after E0, ED, F0 and F4, and by refusing
+// C0, C1 and F5-FF as leads. Returns the number of bytes taken, which
+// is always all of them.
+size_t HIDGenericImpl::Keyboard::writeUtf8(
+    HIDGenericImpl& hid,
+    const uint8_t* buffer,
+    size_t size
+)
+{
+    for (size_t i = 0; i < size; i++) {
+        uint8_t c = buffer[i];
+
+        if (utf8Need_m) {
+            if (c >= utf8Low_m && c <= utf8High_m) {
+                utf8Code_m = (utf8Code_m << 6) | (c & 0x3f);
+                utf8Low_m  = 0x80;
+                utf8High_m = 0xbf;
+                if (--utf8Need_m == 0) {
+                    writeCodepoint(hid, utf8Code_m);
+                }
+                continue;
+            }
+            // Sequence cut short or not allowed - start again with
+            // this byte
+            utf8Need_m = 0;
+            utf8Low_m  = 0x80;
+            utf8High_m = 0xbf;
+        }
+
+        if (c < 0x80) {
+            writeCodepoint(hid, c);
+        }
+        else if (c >= 0xc2 && c <= 0xdf) {
+            utf8Code_m = c & 0x1f;
+            utf8Need_m = 1;
+        }
+        else if (c >= 0xe0 && c <= 0xef) {
+            if (c == 0xe0) {
+                utf8Low_m = 0xa0;
+            }
+            else if (c == 0xed) {
+                utf8High_m = 0x9f;
+            }
+            utf8Code_m = c & 0x0f;
+            utf8Need_m = 2;
+        }
+        else if (c >= 0xf0 && c <= 0xf4) {
+            if (c == 0xf0) {
+                utf8Low_m = 0x90;
+            }
+            else if (c == 0xf4) {
+                utf8High_m = 0x8f;
+            }
+            utf8Code_m = c & 0x07;
+            utf8Need_m = 3;
+        }
+    }
+    return size;
+}
+
+bool HIDGenericImpl::Keyboard::handleEvent(HIDGenericImpl& hid, const Event& event)
+{
+    switch (event.type) {
+    case EVENT_KEY_PRESS:
+        press(hid, event.args[0]);
+        return true;
+    case EVENT_KEY_RELEASE:
+        release(hid, event.args[0]);
+        return true;
+    }
+    return false;
+}
+
+bool HIDGenericImpl::Keyboard::handleOutputReport(
+    uint8_t id,
+    const uint8_t* data,
+    uint32_t len
+)
+{
+    if (id != KEYBOARD_REPORT_ID || len < 1) {
+        return false;
+    }
+    setLeds(data[0]);
+    return true;
+}
+
+
+
+
+// HIDGenericImpl ConsumerControl Methods
+
+HIDGenericImpl::ConsumerControl::ConsumerControl()
+{
+    memset(usages_m, 0, sizeof(usages_m));
+}
+
+void HIDGenericImpl::ConsumerControl::begin(void)
+{
+}
+
+void HIDGenericImpl::ConsumerControl::end(void)
+{
+}
+
+// The report is sent little endian whatever the CPU is
+void HIDGenericImpl::ConsumerControl::sendReport(HIDGenericImpl& hid)
+{
+    uint8_t r[USAGE_SLOTS * 2];
+
+    if (hid.holdReport(CONSUMER_REPORT_ID)) {
+        return;
+    }
+    for (uint8_t i = 0; i < USAGE_SLOTS; i++) {
+        r[i*2]   = usages_m[i] & 0xff;
+        r[i*2+1] = usages_m[i] >> 8;
+    }
+    hid.sendReport(CONSUMER_REPORT_ID, r, sizeof(r));
+}
+
+int8_t HIDGenericImpl::ConsumerControl::findUsage(uint16_t usage)
+{
+    for (uint8_t i = 0; i < USAGE_SLOTS; i++) {
+        if (usages_m[i] == usage) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool HIDGenericImpl::ConsumerControl::isPressed(uint16_t usage)
+{
+    return usage && findUsage(usage) >= 0;
+}
+
+size_t HIDGenericImpl::ConsumerControl::press(HIDGenericImpl& hid, uint16_t usage)
+{
+    if (!usage) {
+        return 0;
+    }
+    if (findUsage(usage) >= 0) {
+        // Already held - the host has nothing new to hear
+        return 1;
+    }
+
+    int8_t i = findUsage(0);
+    if (i < 0) {
+        return 0;
+    }
+    usages_m[i] = usage;
+    sendReport(hid);
+    return 1;
+}
+
+size_t HIDGenericImpl::ConsumerControl::release(HIDGenericImpl& hid, uint16_t usage)
+{
+    int8_t i = usage ? findUsage(usage) : -1;
+
+    if (i < 0) {
+        return 0;
+    }
+    usages_m[i] = 0;
+    sendReport(hid);
+    return 1;
+}
+
+size_t HIDGenericImpl::ConsumerControl::tap(HIDGenericImpl& hid, uint16_t usage)
+{
+    if (isPressed(usage)) {
+        // Let go first so that the host sees a fresh press
+        release(hid, usage);
+    }
+    if (!press(hid, usage)) {
+        return 0;
+    }
+    return release(hid, usage);
+}
+
+void HIDGenericImpl::ConsumerControl::releaseAll(HIDGenericImpl& hid)
+{
+    for (uint8_t i = 0; i < USAGE_SLOTS; i++) {
+        if (usages_m[i]) {
+            memset(usages_m, 0, sizeof(usages_m));
+            sendReport(hid);
+            return;
+        }
+    }
+}
+
+void HIDGenericImpl::ConsumerControl::commit(HIDGenericImpl& hid)
+{
+    if (hid.isReportHeld(CONSUMER_REPORT_ID)) {
+        sendReport(hid);
+    }
+}
+
+bool HIDGenericImpl::ConsumerControl::handleEvent(HIDGenericImpl& hid, const Event& event)
+{
+    uint16_t usage = event.args[0] | (event.args[1] << 8);
+
+    switch (event.type) {
+    case EVENT_CONSUMER_PRESS:
+        press(hid, usage);
+        return true;
+    case EVENT_CONSUMER_RELEASE:
+        release(hid, usage);
+        return true;
+    }
+    return false;
+}
+
+
+
+
+// HIDGenericImpl Gamepad Methods
+
+HIDGenericImpl::Gamepad::Gamepad()
+{
+    reset();
+}
+
+void HIDGenericImpl::Gamepad::begin(void)
+{
+}
+
+void HIDGenericImpl::Gamepad::end(void)
+{
+}
+
+void HIDGenericImpl::Gamepad::reset(void)
+{
+    memset(report_m, 0, sizeof(report_m));
+    report_m[REPORT_HATS] = (HAT_CENTERED << 4) | HAT_CENTERED;
+    dirty_m = true;
+}
+
+// Write one byte of the report, only dirtying it on a change
+void HIDGenericImpl::Gamepad::update(uint8_t offset, uint8_t value)
+{
+    if (report_m[offset] != value) {
+        report_m[offset] = value;
+        dirty_m = true;
+    }
+}
+
+void HIDGenericImpl::Gamepad::setButton(uint8_t b, bool pressed)
+{
+    if (b >= BUTTONS) {
+        return;
+    }
+    uint8_t bit = 1 << (b & 7);
+    uint8_t old = report_m[b >> 3];
+    update(b >> 3, pressed ? old | bit : old & ~bit);
+}
+
+void HIDGenericImpl::Gamepad::press(uint8_t b)
+{
+    setButton(b, true);
+}
+
+void HIDGenericImpl::Gamepad::release(uint8_t b)
+{
+    setButton(b, false);
+}
+
+void HIDGenericImpl::Gamepad::setButtons(uint32_t buttons)
+{
+    update(0, buttons & 0xff);
+    update(1, (buttons >> 8) & 0xff);
+    update(2, (buttons >> 16) & 0xff);
+    update(3, buttons >> 24);
+}
+
+bool HIDGenericImpl::Gamepad::isPressed(uint8_t b)
+{
+    return b < BUTTONS && (report_m[b >> 3] & (1 << (b & 7)));
+}
+
+// Anything past HAT_UP_LEFT is sent as the null (centred) state
+void HIDGenericImpl::Gamepad::setHat(uint8_t hat, uint8_t direction)
+{
+    if (hat >= HATS) {
+        return;
+    }
+    if (direction > HAT_CENTERED) {
+        direction = HAT_CENTERED;
+    }
+
+    uint8_t shift = hat * 4;
+    uint8_t old = report_m[REPORT_HATS];
+    update(REPORT_HATS, (old & ~(0x0f << shift)) | (direction << shift));
+}
+
+void HIDGenericImpl::Gamepad::setAxis(uint8_t axis, Axis value)
+{
+    if (axis >= AXES) {
+        return;
+    }
+
+    // The most negative value is outside the logical range
+    if (value < AXIS_MIN) {
+        value = AXIS_MIN;
+    }
+
+    uint8_t offset = REPORT_AXES + axis * sizeof(Axis);
+    update(offset, (uint8_t)value);
+#if HIDGENERIC_GAMEPAD_AXIS_BITS == 16
+    update(offset + 1, (uint16_t)value >> 8);
+#endif
+}
+
+bool HIDGenericImpl::Gamepad::flush(HIDGenericImpl& hid)
+{
+    if (!dirty_m || hid.holdReport(GAMEPAD_REPORT_ID)) {
+        return false;
+    }
+    dirty_m = false;
+    hid.sendReport(GAMEPAD_REPORT_ID, report_m, REPORT_SIZE);
+    return true;
+}
+
+void HIDGenericImpl::Gamepad::commit(HIDGenericImpl& hid)
+{
+    if (hid.isReportHeld(GAMEPAD_REPORT_ID)) {
+        flush(hid);
+    }
+}
+
 //#endif
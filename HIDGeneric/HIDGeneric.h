@@ -22,12 +22,78 @@
 
 #include "Arduino.h"
 
+// Build settings
+//
+// Edit the values below to change them. HIDGeneric.cpp is compiled on
+// its own, so defining one of these in a sketch before including this
+// header does not reach it - the sketch and the library would then
+// disagree about the size and layout of the classes. A compiler flag
+// (-D) applied to the whole build is fine.
+
+// Number of events that can be queued from interrupt handlers before
+// they are processed in the main loop. Must be a power of two no larger
+// than 128.
+#ifndef HIDGENERIC_EVENT_QUEUE_SIZE
+#define HIDGENERIC_EVENT_QUEUE_SIZE 16
+#endif
+
+// Number of characters that can wait to be typed by the keyboard's
+// paced type() methods. Must be a power of two no larger than 128.
+#ifndef HIDGENERIC_TYPE_AHEAD
+#define HIDGENERIC_TYPE_AHEAD 16
+#endif
+
+// Keyboard layout the host is set to, used to turn characters into
+// keys. One of the HIDGENERIC_LAYOUT_* values.
+#define HIDGENERIC_LAYOUT_US 0
+#define HIDGENERIC_LAYOUT_DE 1
+#define HIDGENERIC_LAYOUT_FR 2
+#ifndef HIDGENERIC_LAYOUT
+#define HIDGENERIC_LAYOUT HIDGENERIC_LAYOUT_US
+#endif
+
+// Resolution of the gamepad axes - 8 or 16 bits
+#ifndef HIDGENERIC_GAMEPAD_AXIS_BITS
+#define HIDGENERIC_GAMEPAD_AXIS_BITS 8
+#endif
+
+// Uncomment to collect per report latency statistics (see
+// HIDGenericImpl::getStats). When it is off none of the code or
+// data for it is compiled in.
+//#define HIDGENERIC_STATS
+
+// Uncomment to trace reports and keystrokes on Serial
+//#define HIDGENERIC_DEBUG
+
+// Uncomment to allow the reports sent to be recorded with HIDCapture
+//#define HIDGENERIC_CAPTURE
+
+// Uncomment for report rate limits and priority classes (see
+// HIDGenericImpl::setLinkRate). When it is off none of the code or
+// data for it is compiled in.
+//#define HIDGENERIC_RATE_LIMIT
+
+class HIDCapture;
+
 // HIDGeneric
 //
 // This is quite similar to the existing (as of Aug 2014) USB HID
 // library that is provided with the Arduino IDE, but it is not
 // tied directly to the USB driver. This means that it can be used
 // for both USB and Bluetooth (and possibly other transports in the future)
+//
+// The devices presented to the host are chosen when HIDGeneric is
+// declared. By default it is a mouse and a keyboard, but for example
+// a keypad only product would use:
+//
+//   HIDGeneric<RN42<typeof Serial3>, HIDKeyboard> hid(rn42Obj);
+//
+// and a keyboard with media keys:
+//
+//   HIDGeneric<RN42<typeof Serial3>, HIDKeyboard, HIDConsumerControl> hid(rn42Obj);
+//
+// Only the listed devices are compiled in and only their collections
+// are included in the report descriptor.
 
 
 class HIDGenericImpl {
@@ -43,11 +109,48 @@ class HIDGenericImpl {
         virtual ~Transport(){};
         virtual void sendReport(const void* data, uint32_t len) = 0;        
         virtual void sendControl(uint8_t flags, const void* d, uint32_t len) = 0;
+
+        // Fetch a pending output report (id followed by data) from the
+        // host. Returns the length of the report or 0 if there is none.
+        // Transports that can't receive anything can leave this alone.
+        virtual int receiveReport(void*, uint32_t) { return 0; }
     };
 
+    // sendControl() flag - the data is in program memory (same value
+    // as the Arduino USB core uses)
+    static const uint8_t TRANSFER_PGM = 0x80;
+
+    // Report IDs used in the report descriptor
+    static const uint8_t MOUSE_REPORT_ID    = 1;
+    static const uint8_t KEYBOARD_REPORT_ID = 2;
+    static const uint8_t CONSUMER_REPORT_ID = 3;
+    static const uint8_t GAMEPAD_REPORT_ID  = 4;
+    static const uint8_t MAX_REPORT_ID      = 4;
+
+    // Event types for the interrupt safe queue
+    static const uint8_t EVENT_KEY_PRESS     = 1;
+    static const uint8_t EVENT_KEY_RELEASE   = 2;
+    static const uint8_t EVENT_MOUSE_MOVE    = 3;
+    static const uint8_t EVENT_MOUSE_PRESS   = 4;
+    static const uint8_t EVENT_MOUSE_RELEASE = 5;
+    static const uint8_t EVENT_CONSUMER_PRESS   = 6;
+    static const uint8_t EVENT_CONSUMER_RELEASE = 7;
+
+    // Queued event - type followed by up to three bytes of arguments
+    typedef struct {
+        uint8_t type;
+        uint8_t args[3];
+#ifdef HIDGENERIC_STATS
+        uint32_t time;
+#endif
+    } Event;
+
     // Mouse class
     //
-    // This provides a compatible mechanism for controlling a HID mouse
+    // This provides a compatible mechanism for controlling a HID mouse.
+    // This class holds the mouse state; applications use it through
+    // the HIDMouse device (see below) which supplies the HIDGenericImpl
+    // to send the reports through.
     class Mouse {
       public:
         
@@ -56,28 +159,46 @@ class HIDGenericImpl {
         static const uint8_t BUTTON_RIGHT  = 2;
         static const uint8_t BUTTON_MIDDLE = 4;
         static const uint8_t BUTTON_ALL    = BUTTON_MIDDLE | BUTTON_RIGHT | BUTTON_LEFT;
+
+        // Report descriptor collection (in program memory)
+        static const uint8_t DESCRIPTOR_SIZE = 54;
+        static const uint8_t descriptor[DESCRIPTOR_SIZE];
         
-	Mouse(HIDGenericImpl* hid_p);
+	Mouse();
 	void begin(void);
 	void end(void);
-	void click(uint8_t b = BUTTON_LEFT);
-	void move(signed char x, signed char y, signed char wheel = 0);
-	void press(uint8_t b = BUTTON_LEFT);	 // press LEFT by default
-	void release(uint8_t b = BUTTON_LEFT);   // release LEFT by default
 	bool isPressed(uint8_t b = BUTTON_ALL);  // check all buttons by default
 
+        static void sendDescriptor(Transport& transport) {
+            transport.sendControl(TRANSFER_PGM, descriptor, DESCRIPTOR_SIZE);
+        }
+
+      protected:
+	void click(HIDGenericImpl& hid, uint8_t b);
+	void move(HIDGenericImpl& hid, signed char x, signed char y, signed char wheel);
+	void press(HIDGenericImpl& hid, uint8_t b);
+	void release(HIDGenericImpl& hid, uint8_t b);
+        bool handleEvent(HIDGenericImpl& hid, const Event& event);
+        void commit(HIDGenericImpl& hid);
+
       private:
-	void buttons(uint8_t b);
+	void buttons(HIDGenericImpl& hid, uint8_t b);
 
 	uint8_t     buttons_m;
-        HIDGenericImpl* hid_mp;
+        uint8_t     sentButtons_m;
+
+        // Movement not sent yet, added up while the report is held back
+        int16_t     heldX_m;
+        int16_t     heldY_m;
+        int16_t     heldWheel_m;
     };
 
 
     // Keyboard class
     // 
     // HID Keyboard interface that is compatible with the Arduino
-    // provided Keyboard library (as of Aug 2014)
+    // provided Keyboard library (as of Aug 2014). As with Mouse, this
+    // holds the state and applications use it through HIDKeyboard.
     class Keyboard {
       public:
 
@@ -118,6 +239,33 @@ class HIDGenericImpl {
         static const uint8_t KEYBOARD_F10         = 0xCB;
         static const uint8_t KEYBOARD_F11         = 0xCC;
         static const uint8_t KEYBOARD_F12         = 0xCD;
+        static const uint8_t KEYBOARD_SCROLL_LOCK = 0xCF;
+        static const uint8_t KEYBOARD_NUM_LOCK    = 0xDB;
+
+        // Any other key: KEYBOARD_USAGE + its usage on the keyboard
+        // page (up to 0x77)
+        static const uint8_t KEYBOARD_USAGE       = 0x88;
+
+        // LED bits as reported by the host in the output report
+        static const uint8_t LED_NUM_LOCK         = 0x01;
+        static const uint8_t LED_CAPS_LOCK        = 0x02;
+        static const uint8_t LED_SCROLL_LOCK      = 0x04;
+        static const uint8_t LED_COMPOSE          = 0x08;
+        static const uint8_t LED_KANA             = 0x10;
+
+        // Typing profiles for setTypingProfile() - starting points for
+        // the typing rate governor (see type())
+        static const uint8_t TYPING_ADAPTIVE      = 0;  // start fast, no floor
+        static const uint8_t TYPING_USB           = 1;  // no gap needed
+        static const uint8_t TYPING_BLUETOOTH     = 2;  // typical BT host
+        static const uint8_t TYPING_SLOW_HOST     = 3;  // worst hosts seen
+
+        // How to enter characters the layout has no key for - see
+        // setUnicodeMethod()
+        static const uint8_t UNICODE_NONE         = 0;
+        static const uint8_t UNICODE_LINUX        = 1;  // Ctrl+Shift+U, hex, space
+        static const uint8_t UNICODE_WINDOWS      = 2;  // Alt, keypad +, hex
+        static const uint8_t UNICODE_MACOS        = 3;  // Option + hex
 
         // Public types
         typedef struct {
@@ -126,67 +274,836 @@ class HIDGenericImpl {
             uint8_t keys[6];
         } KeyReport;
 
+        // Report descriptor collection (in program memory)
+        static const uint8_t DESCRIPTOR_SIZE = 65;
+        static const uint8_t descriptor[DESCRIPTOR_SIZE];
+
         // Methods
-        Keyboard(HIDGenericImpl* hid_p);
+        Keyboard();
 	void begin(void);
 	void end(void);
-	size_t write(uint8_t key);
-	size_t press(uint8_t key);
-	size_t release(uint8_t key);
-	void releaseAll(void);
+
+        // LED state as last reported by the host. setLeds() is called
+        // when an output report arrives, but may also be used to seed
+        // the state if it is known by other means.
+        uint8_t getLeds(void) { return leds_m; }
+        void setLeds(uint8_t leds) { leds_m = leds; }
+
+        // Typing rate governor
+        //
+        // type() queues characters and poll() sends them with a gap
+        // between reports that the governor adjusts. It starts with
+        // the profile's gap and shortens it after every run of
+        // keystrokes that goes by without a drop being reported.
+        // reportTypingDrop() (e.g. when an echo of the typed text
+        // doesn't match) backs it off and remembers the gap that
+        // failed, so it settles just above the fastest rate the host
+        // can take. write() is not paced.
+        void setTypingProfile(uint8_t profile);
+        void setTypingGap(uint32_t start, uint32_t min, uint32_t max);
+        void reportTypingDrop(void);
+        uint32_t getTypingGap(void) { return gap_m; }
+        bool isTyping(void) { return typeHead_m != typeTail_m || typed_m; }
+
+        // Characters per second achieved while typing
+        uint16_t getTypingRate(void);
+        void resetTypingRate(void);
+
+        // Unicode entry for characters that aren't on the layout.
+        // UNICODE_LINUX works with IBus and GTK. UNICODE_WINDOWS needs
+        // EnableHexNumpad set to 1 under HKCU\Control Panel\Input
+        // Method. UNICODE_MACOS needs the Unicode Hex Input source.
+        void setUnicodeMethod(uint8_t method) { unicodeMethod_m = method; }
+
+        static void sendDescriptor(Transport& transport) {
+            transport.sendControl(TRANSFER_PGM, descriptor, DESCRIPTOR_SIZE);
+        }
+
+      protected:
+	size_t write(HIDGenericImpl& hid, uint8_t key);
+	size_t write(HIDGenericImpl& hid, const uint8_t* buffer, size_t size);
+	size_t press(HIDGenericImpl& hid, uint8_t key);
+	size_t release(HIDGenericImpl& hid, uint8_t key);
+	void releaseAll(HIDGenericImpl& hid);
+        bool setLock(HIDGenericImpl& hid, uint8_t led, uint8_t key, bool on);
+        size_t type(const uint8_t* buffer, size_t size);
+        void poll(HIDGenericImpl& hid);
+        size_t writeCodepoint(HIDGenericImpl& hid, uint32_t c);
+        size_t writeUtf8(HIDGenericImpl& hid, const uint8_t* buffer, size_t size);
+        bool handleEvent(HIDGenericImpl& hid, const Event& event);
+        bool handleOutputReport(uint8_t id, const uint8_t* data, uint32_t len);
+        void commit(HIDGenericImpl& hid);
         
       private:
 
-        static const uint8_t asciimap[128];
+        static const uint8_t TYPE_AHEAD_MASK = HIDGENERIC_TYPE_AHEAD - 1;
+
+        // Every input byte to usage (low byte) and modifiers (high byte)
+        static const uint16_t keymap[256];
 
 
         // Private methods
-	void sendReport(KeyReport* keys);
+	void sendReport(HIDGenericImpl& hid);
+        uint16_t lookup(uint8_t k);
+        size_t pressText(HIDGenericImpl& hid, uint8_t k);
+        size_t pressEntry(HIDGenericImpl& hid, uint16_t entry);
+        int8_t findKey(uint8_t k);
+        bool addKey(uint8_t k);
+        void removeKey(uint8_t k);
+        void tap(HIDGenericImpl& hid, uint8_t usage, uint8_t modifiers);
+        void tapStroke(HIDGenericImpl& hid, uint16_t stroke);
+        uint16_t hexKey(uint8_t digit);
+        size_t writeUnicode(HIDGenericImpl& hid, uint32_t c);
 
         // Data members
         KeyReport   keys_m;
-        HIDGenericImpl* hid_mp;
+        uint8_t     leds_m;
+
+        // Modifiers press() added for a key rather than the application
+        uint8_t     addedModifiers_m;
+
+        // Typing governor - typed_m is the key that is down (0 if
+        // none), all times in microseconds
+        uint8_t     typeAhead_m[HIDGENERIC_TYPE_AHEAD];
+        uint8_t     typeHead_m;
+        uint8_t     typeTail_m;
+        uint8_t     typed_m;
+        uint8_t     streak_m;
+        uint32_t    gap_m;
+        uint32_t    minGap_m;
+        uint32_t    maxGap_m;
+        uint32_t    failedGap_m;
+        uint32_t    lastTyped_m;
+        uint32_t    typingTime_m;
+        uint32_t    typedChars_m;
+
+        // UTF-8 decoder - the code point so far, the number of
+        // continuation bytes still to come and the range the next
+        // one has to be in
+        uint32_t    utf8Code_m;
+        uint8_t     utf8Need_m;
+        uint8_t     utf8Low_m;
+        uint8_t     utf8High_m;
+        uint8_t     unicodeMethod_m;
+
+    };
+
+
+    // ConsumerControl class
+    //
+    // Media keys (volume, transport controls, brightness and so on)
+    // from the Consumer page. The report is an array of up to
+    // USAGE_SLOTS 16 bit usages, so several keys can be held at once
+    // and any usage on the page can be sent, not just the ones below.
+    // Applications use it through HIDConsumerControl.
+    class ConsumerControl {
+      public:
+
+        // Some common usages
+        static const uint16_t CONSUMER_BRIGHTNESS_UP   = 0x006F;
+        static const uint16_t CONSUMER_BRIGHTNESS_DOWN = 0x0070;
+        static const uint16_t CONSUMER_NEXT_TRACK      = 0x00B5;
+        static const uint16_t CONSUMER_PREVIOUS_TRACK  = 0x00B6;
+        static const uint16_t CONSUMER_STOP            = 0x00B7;
+        static const uint16_t CONSUMER_EJECT           = 0x00B8;
+        static const uint16_t CONSUMER_PLAY_PAUSE      = 0x00CD;
+        static const uint16_t CONSUMER_MUTE            = 0x00E2;
+        static const uint16_t CONSUMER_VOLUME_UP       = 0x00E9;
+        static const uint16_t CONSUMER_VOLUME_DOWN     = 0x00EA;
+        static const uint16_t CONSUMER_CALCULATOR      = 0x0192;
+        static const uint16_t CONSUMER_BROWSER_HOME    = 0x0223;
+        static const uint16_t CONSUMER_BROWSER_BACK    = 0x0224;
+        static const uint16_t CONSUMER_BROWSER_FORWARD = 0x0225;
+
+        static const uint8_t USAGE_SLOTS = 4;
+
+        // Report descriptor collection (in program memory)
+        static const uint8_t DESCRIPTOR_SIZE = 25;
+        static const uint8_t descriptor[DESCRIPTOR_SIZE];
+
+        ConsumerControl();
+	void begin(void);
+	void end(void);
+        bool isPressed(uint16_t usage);
 
+        static void sendDescriptor(Transport& transport) {
+            transport.sendControl(TRANSFER_PGM, descriptor, DESCRIPTOR_SIZE);
+        }
+
+      protected:
+        // press() and release() only send a report if the set of held
+        // usages changes. They return 0 if nothing was sent because
+        // all the slots were in use or the usage wasn't held.
+        size_t press(HIDGenericImpl& hid, uint16_t usage);
+        size_t release(HIDGenericImpl& hid, uint16_t usage);
+        size_t tap(HIDGenericImpl& hid, uint16_t usage);
+        void releaseAll(HIDGenericImpl& hid);
+        bool handleEvent(HIDGenericImpl& hid, const Event& event);
+        void commit(HIDGenericImpl& hid);
+
+      private:
+        void sendReport(HIDGenericImpl& hid);
+        int8_t findUsage(uint16_t usage);
+
+        uint16_t    usages_m[USAGE_SLOTS];
     };
 
 
+    // Gamepad class
+    //
+    // 32 buttons, 2 hat switches and 6 axes (X, Y, Z, Rx, Ry, Rz). The
+    // report is kept packed as it is sent; the setters update it in
+    // place and mark it dirty if anything changed. Nothing is sent
+    // until flush(), which sends one report at most and only if the
+    // report is dirty, so a control loop can set everything on every
+    // pass and call flush() without flooding the link.
+    //
+    // The axes are signed and HIDGENERIC_GAMEPAD_AXIS_BITS wide.
+    // Applications use it through HIDGamepad.
+    class Gamepad {
+      public:
+
+        static const uint8_t BUTTONS = 32;
+        static const uint8_t HATS    = 2;
+        static const uint8_t AXES    = 6;
+
+        // Axis numbers
+        static const uint8_t AXIS_X  = 0;
+        static const uint8_t AXIS_Y  = 1;
+        static const uint8_t AXIS_Z  = 2;
+        static const uint8_t AXIS_RX = 3;
+        static const uint8_t AXIS_RY = 4;
+        static const uint8_t AXIS_RZ = 5;
+
+        // Hat directions, clockwise from up
+        static const uint8_t HAT_UP         = 0;
+        static const uint8_t HAT_UP_RIGHT   = 1;
+        static const uint8_t HAT_RIGHT      = 2;
+        static const uint8_t HAT_DOWN_RIGHT = 3;
+        static const uint8_t HAT_DOWN       = 4;
+        static const uint8_t HAT_DOWN_LEFT  = 5;
+        static const uint8_t HAT_LEFT       = 6;
+        static const uint8_t HAT_UP_LEFT    = 7;
+        static const uint8_t HAT_CENTERED   = 8;
+
+#if HIDGENERIC_GAMEPAD_AXIS_BITS == 16
+        typedef int16_t Axis;
+        static const Axis AXIS_MAX = 32767;
+        static const uint8_t DESCRIPTOR_SIZE = 76;
+#elif HIDGENERIC_GAMEPAD_AXIS_BITS == 8
+        typedef int8_t Axis;
+        static const Axis AXIS_MAX = 127;
+        static const uint8_t DESCRIPTOR_SIZE = 74;
+#else
+#error HIDGENERIC_GAMEPAD_AXIS_BITS must be 8 or 16
+#endif
+        static const Axis AXIS_MIN = -AXIS_MAX;
+
+        // Report layout - buttons, both hats in one byte, then the axes
+        // (little endian if they are 16 bits)
+        static const uint8_t REPORT_HATS = 4;
+        static const uint8_t REPORT_AXES = 5;
+        static const uint8_t REPORT_SIZE = REPORT_AXES + AXES * sizeof(Axis);
+
+        // Report descriptor collection (in program memory)
+        static const uint8_t descriptor[DESCRIPTOR_SIZE];
+
+        Gamepad();
+	void begin(void);
+	void end(void);
+
+        // Buttons are numbered from 0. Out of range buttons, hats and
+        // axes are ignored.
+        void press(uint8_t b);
+        void release(uint8_t b);
+        void setButton(uint8_t b, bool pressed);
+        void setButtons(uint32_t buttons);
+        bool isPressed(uint8_t b);
+        void setHat(uint8_t hat, uint8_t direction);
+        void setAxis(uint8_t axis, Axis value);
+
+        // Back to no buttons, centred hats and zero axes
+        void reset(void);
+
+        bool isDirty(void) { return dirty_m; }
+
+        static void sendDescriptor(Transport& transport) {
+            transport.sendControl(TRANSFER_PGM, descriptor, DESCRIPTOR_SIZE);
+        }
+
+      protected:
+        // Returns true if a report was sent
+        bool flush(HIDGenericImpl& hid);
+        void commit(HIDGenericImpl& hid);
+
+      private:
+        void update(uint8_t offset, uint8_t value);
+
+        uint8_t     report_m[REPORT_SIZE];
+        bool        dirty_m;
+    };
+
+
+#ifdef HIDGENERIC_STATS
+    // Latency statistics for one report ID
+    //
+    // A report is timestamped when it is submitted (queued by an
+    // interrupt handler or sent by a direct call), when it is taken
+    // off the queue and when the transport has sent the last byte.
+    // Latency is measured from submit to completion; bucket 0 of the
+    // histogram counts latencies under 1us and bucket n those from
+    // 2^(n-1) up to 2^n us, with the last bucket taking everything
+    // longer. Blocking is the time spent in the transport.
+    static const uint8_t STATS_BUCKETS = 16;
+
+    typedef struct {
+        uint16_t count;
+        uint16_t histogram[STATS_BUCKETS];
+        uint32_t maxLatency;
+        uint32_t maxQueueWait;
+        uint32_t maxBlocking;
+    } ReportStats;
+#endif
+
     // HIDGenericImpl public methods
     HIDGenericImpl(Transport* transport_p);
 
     void begin(void);
     int	getInterface(uint8_t* interfaceNum);
-    int getDescriptor(int i);
     bool setup(Setup& setup);
     void sendReport(uint8_t id, const void* data, uint32_t len);
 
-    Mouse& getMouse() {
-        return mouse_m;
+    // Interrupt safe event queue
+    //
+    // Keyboard and Mouse must only be used from the main loop. Interrupt
+    // handlers instead push events with the queue methods below, which
+    // never block and only touch the queue. This is a single producer,
+    // single consumer queue, so only one interrupt handler (or several
+    // that can't interrupt each other) may push events. The events are
+    // applied to the devices by HIDGeneric::processEvents(), which is
+    // also called by HIDGeneric::poll(). Consecutive mouse moves are
+    // merged into one report where possible.
+    //
+    // The queue methods return false and count the event as dropped if
+    // the queue is full.
+    bool queueEvent(uint8_t type, uint8_t a, uint8_t b = 0, uint8_t c = 0);
+    bool queueKeyPress(uint8_t key) {
+        return queueEvent(EVENT_KEY_PRESS, key);
     }
-    
-    Keyboard& getKeyboard() {
-        return keyboard_m;
+    bool queueKeyRelease(uint8_t key) {
+        return queueEvent(EVENT_KEY_RELEASE, key);
+    }
+    bool queueMouseMove(signed char x, signed char y, signed char wheel = 0) {
+        return queueEvent(EVENT_MOUSE_MOVE, x, y, wheel);
+    }
+    bool queueMousePress(uint8_t b = Mouse::BUTTON_LEFT) {
+        return queueEvent(EVENT_MOUSE_PRESS, b);
+    }
+    bool queueMouseRelease(uint8_t b = Mouse::BUTTON_LEFT) {
+        return queueEvent(EVENT_MOUSE_RELEASE, b);
     }
+    bool queueConsumerPress(uint16_t usage) {
+        return queueEvent(EVENT_CONSUMER_PRESS, usage & 0xff, usage >> 8);
+    }
+    bool queueConsumerRelease(uint16_t usage) {
+        return queueEvent(EVENT_CONSUMER_RELEASE, usage & 0xff, usage >> 8);
+    }
+    uint16_t getDroppedEvents(void);
+    void resetDroppedEvents(void);
+
+    // Consumer side of the queue - takes the next event (with any
+    // mouse moves that can be merged into it). Returns false once the
+    // queue is empty.
+    bool nextEvent(Event& event);
+
+    // Transactions
+    //
+    // While a transaction is open the devices only update their state
+    // and note which of their reports are being held back.
+    // HIDGeneric::commit() then sends one report for each held report
+    // ID, so a chord such as Ctrl+Shift+Esc reaches the host in one
+    // report, as do a button change and a move together. Moves made
+    // during a transaction are added up (and go in as many reports as
+    // it takes if one can't carry them). Anything that has to be seen
+    // by the host as separate reports, e.g. write() or click(), cancels
+    // out. They can be nested; only the outermost commit sends.
+    void beginTransaction(void) {
+        transaction_m++;
+    }
+    bool endTransaction(void) {
+        if (transaction_m && --transaction_m) {
+            return false;
+        }
+        return true;
+    }
+
+    // Used by the devices - returns true (and holds the report back)
+    // if a transaction is open or the rate limits (below) don't let
+    // the report go yet. An urgent report, one that would be lost by
+    // being merged into the next (a mouse button change), is only held
+    // by a transaction. Sending a report of that ID releases it.
+    bool holdReport(uint8_t id, bool urgent = false) {
+        if (!transaction_m) {
+#ifdef HIDGENERIC_RATE_LIMIT
+            if (urgent || !limitReport(id)) {
+                return false;
+            }
+#else
+            (void)urgent;
+            return false;
+#endif
+        }
+        heldReports_m |= 1 << id;
+        return true;
+    }
+    bool isReportHeld(uint8_t id) {
+        return heldReports_m & (1 << id);
+    }
+
+#ifdef HIDGENERIC_RATE_LIMIT
+    // Rate limits and priorities
+    //
+    // Every report ID is in a priority class. Reports in PRIORITY_HIGH
+    // (the keyboard and consumer control by default) are never held
+    // back, as merging them would lose key presses; they go at once
+    // but still use up the link's budget. Reports in the lower classes
+    // (the gamepad, then the mouse) are held back while their own limit
+    // or the link's is used up, and wait for any held report of a
+    // higher class. The device keeps updating a held report (moves are
+    // added up) and HIDGeneric::poll() sends it when there is room.
+    //
+    // Limits are token buckets of burst reports, refilled at perSecond
+    // reports a second; a rate of 0 is no limit. Class n needs n tokens
+    // left in the link's bucket (or a full one if the burst is
+    // smaller), so motion always leaves room for the next key press.
+    static const uint8_t PRIORITY_HIGH    = 0;
+    static const uint8_t PRIORITY_NORMAL  = 1;
+    static const uint8_t PRIORITY_LOW     = 2;
+    static const uint8_t PRIORITY_CLASSES = 3;
+
+    void setReportPriority(uint8_t id, uint8_t priority);
+    void setReportRate(uint8_t id, uint16_t perSecond, uint8_t burst = 1);
+    void setLinkRate(uint16_t perSecond, uint8_t burst = 4);
+
+    // True if a held report can go now
+    bool isReportReady(void);
+
+    // Use of the link by one class: reports and bytes sent (with the
+    // report IDs), how often a report was held back and how long held
+    // reports waited in us
+    typedef struct {
+        uint32_t reports;
+        uint32_t bytes;
+        uint16_t held;
+        uint32_t totalWait;
+        uint32_t maxWait;
+    } ClassStats;
+
+    const ClassStats& getClassStats(uint8_t priority) {
+        return classStats_m[priority < PRIORITY_CLASSES ? priority : PRIORITY_LOW];
+    }
+    void resetClassStats(void);
+#endif
+
+#ifdef HIDGENERIC_CAPTURE
+    // Record every report sent from now on (NULL to stop)
+    void setCapture(HIDCapture* capture_p) {
+        capture_mp = capture_p;
+    }
+#endif
+
+#ifdef HIDGENERIC_STATS
+    // Statistics for a report ID (1 to MAX_REPORT_ID)
+    const ReportStats& getStats(uint8_t id) {
+        return stats_m[id <= MAX_REPORT_ID ? id : 0];
+    }
+    void resetStats(void);
+#endif
 
 
   private:
 
-    static const uint8_t hidReportDescriptor[192];
-    
+    static const uint8_t EVENT_QUEUE_MASK = HIDGENERIC_EVENT_QUEUE_SIZE - 1;
+
+#ifdef HIDGENERIC_STATS
+    void recordStats(uint8_t id, uint32_t submit, uint32_t dequeue, uint32_t done);
+#endif
+
+#ifdef HIDGENERIC_RATE_LIMIT
+    // Token bucket - credit is in us, one interval per report. It goes
+    // below zero when a high priority report is sent on an empty
+    // bucket, which holds the lower classes back for longer.
+    typedef struct {
+        int32_t  credit;
+        uint32_t interval;
+        uint32_t last;
+        uint8_t  burst;
+    } Bucket;
+
+    static bool hasTokens(Bucket& bucket, uint8_t tokens, uint32_t now);
+    static void takeToken(Bucket& bucket, uint32_t now);
+    bool mayPass(uint8_t id, uint32_t now);
+    bool limitReport(uint8_t id);
+    void accountReport(uint8_t id, uint32_t len);
+#endif
+
     // HIDGenericImpl data members
-    Mouse         mouse_m;
-    Keyboard      keyboard_m;
     Transport*    transport_mp;
 
+    // The interrupt handler only writes eventHead_m and droppedEvents_m,
+    // the main loop only writes eventTail_m and droppedBase_m
+    Event            events_m[HIDGENERIC_EVENT_QUEUE_SIZE];
+    volatile uint8_t eventHead_m;
+    volatile uint8_t eventTail_m;
+    volatile uint16_t droppedEvents_m;
+    uint16_t         droppedBase_m;
+
+    uint8_t          transaction_m;
+    uint8_t          heldReports_m;
+
+#ifdef HIDGENERIC_CAPTURE
+    HIDCapture*      capture_mp;
+#endif
+
+#ifdef HIDGENERIC_RATE_LIMIT
+    Bucket           link_m;
+    Bucket           rates_m[MAX_REPORT_ID + 1];
+    uint8_t          priority_m[MAX_REPORT_ID + 1];
+    uint32_t         waitStart_m[MAX_REPORT_ID + 1];
+    uint8_t          waiting_m;
+    ClassStats       classStats_m[PRIORITY_CLASSES];
+#endif
+
+#ifdef HIDGENERIC_STATS
+    // Slot 0 collects anything sent with an unknown report ID
+    ReportStats      stats_m[MAX_REPORT_ID + 1];
+    uint32_t         submitTime_m;
+    uint32_t         dequeueTime_m;
+    bool             queued_m;
+#endif
+
 };
 
 
-template <typename TransportClass>
-class HIDGeneric {
+// Device policies
+//
+// These are the devices that can be listed in the HIDGeneric template
+// arguments. Each provides a Device class template that HIDGeneric
+// derives from. Host is the HIDGeneric class itself, which is how a
+// device gets to the HIDGenericImpl it sends through without having
+// to keep a pointer to it.
+//
+// There is no raw (vendor defined) policy. The RN-42 is the only
+// transport here and its HID profiles have fixed descriptors with no
+// vendor report, so a raw report would have nowhere to go; the old
+// RAWHID collection was never enabled for the same reason.
+
+// HIDMouse
+//
+// Mouse compatible with the Arduino provided Mouse library
+struct HIDMouse {
+    template <typename Host>
+    class Device : public HIDGenericImpl::Mouse {
+      public:
+	void click(uint8_t b = BUTTON_LEFT) {
+            Mouse::click(impl(), b);
+        }
+	void move(signed char x, signed char y, signed char wheel = 0) {
+            Mouse::move(impl(), x, y, wheel);
+        }
+	void press(uint8_t b = BUTTON_LEFT) {	 // press LEFT by default
+            Mouse::press(impl(), b);
+        }
+	void release(uint8_t b = BUTTON_LEFT) {  // release LEFT by default
+            Mouse::release(impl(), b);
+        }
+
+        // Used by HIDGeneric
+        void poll(void) {}
+        void commit(void) {
+            Mouse::commit(impl());
+        }
+        bool handleEvent(const HIDGenericImpl::Event& event) {
+            return Mouse::handleEvent(impl(), event);
+        }
+        bool handleOutputReport(uint8_t, const uint8_t*, uint32_t) {
+            return false;
+        }
+
+      private:
+        HIDGenericImpl& impl() {
+            return static_cast<Host*>(this)->getImpl();
+        }
+    };
+};
+
+// HIDKeyboard
+//
+// Keyboard compatible with the Arduino provided Keyboard library
+struct HIDKeyboard {
+    template <typename Host>
+    class Device : public HIDGenericImpl::Keyboard {
+      public:
+	size_t write(uint8_t key) {
+            return Keyboard::write(impl(), key);
+        }
+	size_t write(const uint8_t* buffer, size_t size) {
+            return Keyboard::write(impl(), buffer, size);
+        }
+	size_t write(const char* str) {
+            return Keyboard::write(impl(), reinterpret_cast<const uint8_t*>(str), strlen(str));
+        }
+
+        // Text in UTF-8, typed with the layout's keys (dead keys and
+        // AltGr as needed) or the Unicode entry method. Unlike write(),
+        // bytes from 0x80 up are never taken as KEYBOARD_* keys.
+        size_t writeUtf8(const uint8_t* buffer, size_t size) {
+            return Keyboard::writeUtf8(impl(), buffer, size);
+        }
+        size_t writeUtf8(const char* str) {
+            return Keyboard::writeUtf8(impl(), reinterpret_cast<const uint8_t*>(str), strlen(str));
+        }
+        size_t writeCodepoint(uint32_t c) {
+            return Keyboard::writeCodepoint(impl(), c);
+        }
+	size_t press(uint8_t key) {
+            return Keyboard::press(impl(), key);
+        }
+	size_t release(uint8_t key) {
+            return Keyboard::release(impl(), key);
+        }
+	void releaseAll(void) {
+            Keyboard::releaseAll(impl());
+        }
+
+        // Bring the lock keys into the requested state. The lock key is
+        // only tapped if the host's LED state says it is needed.
+        // Returns true if a key was sent.
+        bool setCapsLock(bool on) {
+            return setLock(impl(), LED_CAPS_LOCK, KEYBOARD_CAPS_LOCK, on);
+        }
+        bool setNumLock(bool on) {
+            return setLock(impl(), LED_NUM_LOCK, KEYBOARD_NUM_LOCK, on);
+        }
+        bool setScrollLock(bool on) {
+            return setLock(impl(), LED_SCROLL_LOCK, KEYBOARD_SCROLL_LOCK, on);
+        }
+
+        // Paced typing - queues as much as fits and returns the
+        // number of characters taken. HIDGeneric::poll() types them.
+        size_t type(uint8_t key) {
+            return Keyboard::type(&key, 1);
+        }
+        size_t type(const uint8_t* buffer, size_t size) {
+            return Keyboard::type(buffer, size);
+        }
+        size_t type(const char* str) {
+            return Keyboard::type(reinterpret_cast<const uint8_t*>(str), strlen(str));
+        }
+
+        // Used by HIDGeneric
+        void poll(void) {
+            Keyboard::poll(impl());
+        }
+        void commit(void) {
+            Keyboard::commit(impl());
+        }
+        bool handleEvent(const HIDGenericImpl::Event& event) {
+            return Keyboard::handleEvent(impl(), event);
+        }
+        bool handleOutputReport(uint8_t id, const uint8_t* data, uint32_t len) {
+            return Keyboard::handleOutputReport(id, data, len);
+        }
+
+      private:
+        HIDGenericImpl& impl() {
+            return static_cast<Host*>(this)->getImpl();
+        }
+    };
+};
+
+// HIDConsumerControl
+//
+// Media keys - volume, play/pause, brightness etc.
+struct HIDConsumerControl {
+    template <typename Host>
+    class Device : public HIDGenericImpl::ConsumerControl {
+      public:
+        size_t press(uint16_t usage) {
+            return ConsumerControl::press(impl(), usage);
+        }
+        size_t release(uint16_t usage) {
+            return ConsumerControl::release(impl(), usage);
+        }
+
+        // Press and release - one report pair
+        size_t tap(uint16_t usage) {
+            return ConsumerControl::tap(impl(), usage);
+        }
+        void releaseAll(void) {
+            ConsumerControl::releaseAll(impl());
+        }
+
+        // Used by HIDGeneric
+        void poll(void) {}
+        void commit(void) {
+            ConsumerControl::commit(impl());
+        }
+        bool handleEvent(const HIDGenericImpl::Event& event) {
+            return ConsumerControl::handleEvent(impl(), event);
+        }
+        bool handleOutputReport(uint8_t, const uint8_t*, uint32_t) {
+            return false;
+        }
+
+      private:
+        HIDGenericImpl& impl() {
+            return static_cast<Host*>(this)->getImpl();
+        }
+    };
+};
+
+// HIDGamepad
+//
+// Gamepad/joystick - see HIDGenericImpl::Gamepad. flush() has to be
+// called to send the changes.
+struct HIDGamepad {
+    template <typename Host>
+    class Device : public HIDGenericImpl::Gamepad {
+      public:
+        bool flush(void) {
+            return Gamepad::flush(impl());
+        }
+
+        // Used by HIDGeneric
+        void poll(void) {}
+        void commit(void) {
+            Gamepad::commit(impl());
+        }
+        bool handleEvent(const HIDGenericImpl::Event&) {
+            return false;
+        }
+        bool handleOutputReport(uint8_t, const uint8_t*, uint32_t) {
+            return false;
+        }
+
+      private:
+        HIDGenericImpl& impl() {
+            return static_cast<Host*>(this)->getImpl();
+        }
+    };
+};
+
+// HIDNoDevice
+//
+// Fills the unused places in the device list
+struct HIDNoDevice {
+    template <typename Host>
+    class Device {
+      public:
+        static const uint8_t DESCRIPTOR_SIZE = 0;
+        static void sendDescriptor(HIDGenericImpl::Transport&) {}
+        void poll(void) {}
+        void commit(void) {}
+        bool handleEvent(const HIDGenericImpl::Event&) {
+            return false;
+        }
+        bool handleOutputReport(uint8_t, const uint8_t*, uint32_t) {
+            return false;
+        }
+    };
+};
+
+
+// HIDDevices
+//
+// Derives from the Device class of each policy in the list, one per
+// level so that the same policy can't end up as a direct base twice.
+// Anything that has to reach every device (events, output reports,
+// the descriptor) is passed down the levels at compile time.
+template <typename Host, typename Device1, typename Device2, typename Device3,
+          typename Device4, typename Device5>
+class HIDDevices :
+    public Device1::template Device<Host>,
+    public HIDDevices<Host, Device2, Device3, Device4, Device5, HIDNoDevice> {
+
+    typedef typename Device1::template Device<Host>                    First;
+    typedef HIDDevices<Host, Device2, Device3, Device4, Device5, HIDNoDevice> Rest;
+
   public:
+    static const uint16_t DESCRIPTOR_SIZE = First::DESCRIPTOR_SIZE + Rest::DESCRIPTOR_SIZE;
 
-    // Typedefs
-    typedef HIDGenericImpl::Mouse    Mouse;
-    typedef HIDGenericImpl::Keyboard Keyboard;
+    static void sendDescriptor(HIDGenericImpl::Transport& transport) {
+        First::sendDescriptor(transport);
+        Rest::sendDescriptor(transport);
+    }
+    void poll(void) {
+        First::poll();
+        Rest::poll();
+    }
+    void commit(void) {
+        First::commit();
+        Rest::commit();
+    }
+    bool handleEvent(const HIDGenericImpl::Event& event) {
+        return First::handleEvent(event) || Rest::handleEvent(event);
+    }
+    bool handleOutputReport(uint8_t id, const uint8_t* data, uint32_t len) {
+        return First::handleOutputReport(id, data, len) ||
+               Rest::handleOutputReport(id, data, len);
+    }
+};
+
+template <typename Host>
+class HIDDevices<Host, HIDNoDevice, HIDNoDevice, HIDNoDevice, HIDNoDevice, HIDNoDevice> {
+  public:
+    static const uint16_t DESCRIPTOR_SIZE = 0;
+
+    static void sendDescriptor(HIDGenericImpl::Transport&) {}
+    void poll(void) {}
+    void commit(void) {}
+    bool handleEvent(const HIDGenericImpl::Event&) {
+        return false;
+    }
+    bool handleOutputReport(uint8_t, const uint8_t*, uint32_t) {
+        return false;
+    }
+};
+
+
+// HIDMouseKeyboard
+//
+// The default device list when none is given - a mouse and a keyboard
+struct HIDMouseKeyboard {};
+
+template <typename Host>
+class HIDDevices<Host, HIDMouseKeyboard, HIDNoDevice, HIDNoDevice, HIDNoDevice, HIDNoDevice> :
+    public HIDDevices<Host, HIDMouse, HIDKeyboard, HIDNoDevice, HIDNoDevice, HIDNoDevice> {
+};
+
+
+template <typename TransportClass,
+          typename Device1 = HIDMouseKeyboard,
+          typename Device2 = HIDNoDevice,
+          typename Device3 = HIDNoDevice,
+          typename Device4 = HIDNoDevice,
+          typename Device5 = HIDNoDevice>
+class HIDGeneric :
+    public HIDDevices<HIDGeneric<TransportClass, Device1, Device2, Device3, Device4, Device5>,
+                      Device1, Device2, Device3, Device4, Device5> {
+
+    typedef HIDDevices<HIDGeneric, Device1, Device2, Device3, Device4, Device5> Devices;
+
+  public:
+
+    // Typedefs - only usable if the device is in the list
+    typedef HIDMouse::Device<HIDGeneric>    Mouse;
+    typedef HIDKeyboard::Device<HIDGeneric> Keyboard;
+    typedef HIDConsumerControl::Device<HIDGeneric> ConsumerControl;
+    typedef HIDGamepad::Device<HIDGeneric>  Gamepad;
+
+    // Total length of the report descriptor
+    static const uint16_t DESCRIPTOR_SIZE = Devices::DESCRIPTOR_SIZE;
     
     // Derived transport class to hook into the Implementation
     class Transport : public HIDGenericImpl::Transport {
@@ -200,6 +1117,9 @@ class HIDGeneric {
         virtual void sendControl(uint8_t flags, const void* d, uint32_t len) {
             transport_mp->sendControl(flags, d, len);
         }                
+        virtual int receiveReport(void* data, uint32_t len) {
+            return transport_mp->receiveReport(data, len);
+        }
     private:
         TransportClass* transport_mp;
     };
@@ -217,13 +1137,161 @@ class HIDGeneric {
     void sendReport(uint8_t id, const void* data, uint32_t len) {
         hidImpl_m.sendReport(id, data, len);
     } 
+
+    // Send the report descriptor, made up of the collections of the
+    // devices in the list
+    int getDescriptor(int i) {
+        Devices::sendDescriptor(transImpl_m);
+        return DESCRIPTOR_SIZE;
+    }
+
+    // Output reports (host to device)
+    //
+    // poll() processes queued events (see processEvents()), gives the
+    // devices their turn (paced typing), sends reports held back by the
+    // rate limits and pulls any pending output reports out of the
+    // transport. It should be called regularly from the main loop.
+    // Transports that are handed the report directly (e.g. USB
+    // SET_REPORT) can call receiveReport() instead.
+    void poll() {
+        uint8_t p[16];
+        int len;
+
+        processEvents();
+        Devices::poll();
+
+#ifdef HIDGENERIC_RATE_LIMIT
+        // Send what the rate limits held back - a pass per class at most
+        for (uint8_t i = 0;
+             i < HIDGenericImpl::PRIORITY_CLASSES && hidImpl_m.isReportReady(); i++) {
+            Devices::commit();
+        }
+#endif
+
+        while ((len = transImpl_m.receiveReport(p, sizeof(p))) > 0) {
+            if ((uint32_t)len > sizeof(p)) {
+                // Truncated by the transport - nothing we know is this long
+                continue;
+            }
+            receiveReport(p[0], p+1, len-1);
+        }
+    }
+
+    void receiveReport(uint8_t id, const void* data, uint32_t len) {
+        Devices::handleOutputReport(id, reinterpret_cast<const uint8_t*>(data), len);
+    }
+
+    // Interrupt safe event queue - see HIDGenericImpl
+    bool queueKeyPress(uint8_t key) {
+        return hidImpl_m.queueKeyPress(key);
+    }
+    bool queueKeyRelease(uint8_t key) {
+        return hidImpl_m.queueKeyRelease(key);
+    }
+    bool queueMouseMove(signed char x, signed char y, signed char wheel = 0) {
+        return hidImpl_m.queueMouseMove(x, y, wheel);
+    }
+    bool queueMousePress(uint8_t b = HIDGenericImpl::Mouse::BUTTON_LEFT) {
+        return hidImpl_m.queueMousePress(b);
+    }
+    bool queueMouseRelease(uint8_t b = HIDGenericImpl::Mouse::BUTTON_LEFT) {
+        return hidImpl_m.queueMouseRelease(b);
+    }
+    bool queueConsumerPress(uint16_t usage) {
+        return hidImpl_m.queueConsumerPress(usage);
+    }
+    bool queueConsumerRelease(uint16_t usage) {
+        return hidImpl_m.queueConsumerRelease(usage);
+    }
+    uint16_t getDroppedEvents() {
+        return hidImpl_m.getDroppedEvents();
+    }
+    void resetDroppedEvents() {
+        hidImpl_m.resetDroppedEvents();
+    }
+
+    // Transactions - see HIDGenericImpl::beginTransaction()
+    //
+    //   hid.beginTransaction();
+    //   hid.getKeyboard().press(KEYBOARD_LEFT_CTRL);
+    //   hid.getKeyboard().press(KEYBOARD_LEFT_SHIFT);
+    //   hid.getKeyboard().press(KEYBOARD_ESC);
+    //   hid.commit();
+    void beginTransaction() {
+        hidImpl_m.beginTransaction();
+    }
+    void commit() {
+        if (hidImpl_m.endTransaction()) {
+            Devices::commit();
+        }
+    }
+
+    // Apply the queued events to the devices - returns the number of
+    // events applied (merged mouse moves count once). Events for
+    // devices that aren't in the list are thrown away.
+    uint8_t processEvents() {
+        HIDGenericImpl::Event event;
+        uint8_t count = 0;
+
+        while (hidImpl_m.nextEvent(event)) {
+            Devices::handleEvent(event);
+            count++;
+        }
+        return count;
+    }
+
+#ifdef HIDGENERIC_CAPTURE
+    void setCapture(HIDCapture* capture_p) {
+        hidImpl_m.setCapture(capture_p);
+    }
+#endif
+
+#ifdef HIDGENERIC_STATS
+    const HIDGenericImpl::ReportStats& getStats(uint8_t id) {
+        return hidImpl_m.getStats(id);
+    }
+    void resetStats() {
+        hidImpl_m.resetStats();
+    }
+#endif
+
+#ifdef HIDGENERIC_RATE_LIMIT
+    // Rate limits and priorities - see HIDGenericImpl::setLinkRate()
+    void setReportPriority(uint8_t id, uint8_t priority) {
+        hidImpl_m.setReportPriority(id, priority);
+    }
+    void setReportRate(uint8_t id, uint16_t perSecond, uint8_t burst = 1) {
+        hidImpl_m.setReportRate(id, perSecond, burst);
+    }
+    void setLinkRate(uint16_t perSecond, uint8_t burst = 4) {
+        hidImpl_m.setLinkRate(perSecond, burst);
+    }
+    const HIDGenericImpl::ClassStats& getClassStats(uint8_t priority) {
+        return hidImpl_m.getClassStats(priority);
+    }
+    void resetClassStats() {
+        hidImpl_m.resetClassStats();
+    }
+#endif
        
     Mouse& getMouse() {
-        return hidImpl_m.getMouse();
+        return *this;
     }
     
     Keyboard& getKeyboard() {
-        return hidImpl_m.getKeyboard();
+        return *this;
+    }
+
+    ConsumerControl& getConsumerControl() {
+        return *this;
+    }
+
+    Gamepad& getGamepad() {
+        return *this;
+    }
+
+    HIDGenericImpl& getImpl() {
+        return hidImpl_m;
     }
 
   private:
@@ -0,0 +1,126 @@
+/*
+** Copyright (c) 2014, Edward Funnekotter
+**
+** Permission to use, copy, modify, and/or distribute this software for
+** any purpose with or without fee is hereby granted, provided that the
+** above copyright notice and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+** WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+** BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+** OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+** WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+** SOFTWARE.
+*/
+
+#include "Arduino.h"
+#include "HIDMatrix.h"
+
+
+// HIDMatrixImpl Methods
+
+HIDMatrixImpl::HIDMatrixImpl(
+    Reader* reader_p,
+    uint8_t rows,
+    uint8_t cols,
+    const uint8_t* keymap_p
+) :
+    reader_mp(reader_p),
+    keymap_mp(keymap_p),
+    rows_m(rows < HIDMATRIX_MAX_ROWS ? rows : HIDMATRIX_MAX_ROWS),
+    cols_m(cols < 16 ? cols : 16),
+    scans_m(0)
+{
+    mask_m = cols_m < 16 ? (1 << cols_m) - 1 : 0xffff;
+    memset(state_m, 0, sizeof(state_m));
+    memset(count0_m, 0, sizeof(count0_m));
+    memset(count1_m, 0, sizeof(count1_m));
+    memset(changes_m, 0, sizeof(changes_m));
+}
+
+// Vertical counter debounce. For every key where the reading differs
+// from the debounced state the two counter bits count up; anywhere it
+// agrees they are cleared. A key whose counter wraps from 3 back to 0
+// while still differing toggles. All of a row's keys go through
+// together in a few word operations.
+uint8_t
+HIDMatrixImpl::scan(void)
+{
+    uint8_t n = 0;
+
+    for (uint8_t row = 0; row < rows_m; row++) {
+        uint16_t delta = (reader_mp->readRow(row) & mask_m) ^ state_m[row];
+
+        if (!delta && !count0_m[row] && !count1_m[row]) {
+            // Settled - nothing to count
+            changes_m[row] = 0;
+            continue;
+        }
+
+        uint16_t c1 = (count1_m[row] ^ count0_m[row]) & delta;
+        uint16_t c0 = ~count0_m[row] & delta;
+        uint16_t toggle = delta & ~(c0 | c1);
+
+        count1_m[row]  = c1;
+        count0_m[row]  = c0;
+        state_m[row]  ^= toggle;
+        changes_m[row] = toggle;
+
+        // Count the bits that changed
+        while (toggle) {
+            toggle &= toggle - 1;
+            n++;
+        }
+    }
+    scans_m++;
+    return n;
+}
+
+
+// HIDMatrixPins Methods
+
+HIDMatrixPins::HIDMatrixPins(
+    const uint8_t* rowPins_p,
+    uint8_t rows,
+    const uint8_t* colPins_p,
+    uint8_t cols
+) :
+    rowPins_mp(rowPins_p),
+    colPins_mp(colPins_p),
+    rows_m(rows),
+    cols_m(cols)
+{
+}
+
+void
+HIDMatrixPins::begin(void)
+{
+    for (uint8_t i = 0; i < rows_m; i++) {
+        pinMode(rowPins_mp[i], INPUT);
+    }
+    for (uint8_t i = 0; i < cols_m; i++) {
+        pinMode(colPins_mp[i], INPUT_PULLUP);
+    }
+}
+
+uint16_t
+HIDMatrixPins::readRow(uint8_t row)
+{
+    uint16_t cols = 0;
+    uint8_t  pin  = rowPins_mp[row];
+
+    pinMode(pin, OUTPUT);
+    digitalWrite(pin, LOW);
+    delayMicroseconds(5);                     // let the columns settle
+
+    for (uint8_t i = 0; i < cols_m; i++) {
+        if (digitalRead(colPins_mp[i]) == LOW) {
+            cols |= 1 << i;
+        }
+    }
+
+    pinMode(pin, INPUT);
+    return cols;
+}
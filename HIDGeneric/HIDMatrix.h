@@ -0,0 +1,205 @@
+/*
+** Copyright (c) 2014, Edward Funnekotter
+**
+** Permission to use, copy, modify, and/or distribute this software for
+** any purpose with or without fee is hereby granted, provided that the
+** above copyright notice and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+** WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+** BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+** OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+** WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+** SOFTWARE.
+*/
+
+#ifndef __HIDMATRIX_H__
+#define __HIDMATRIX_H__
+
+#if defined __cplusplus
+
+#include "Arduino.h"
+#include "HIDGeneric.h"
+
+// Largest number of rows a matrix can have. Columns are limited to 16
+// (one bit each in a word).
+#ifndef HIDMATRIX_MAX_ROWS
+#define HIDMATRIX_MAX_ROWS 8
+#endif
+
+// HIDMatrixImpl
+//
+// Scans and debounces a key switch matrix a row at a time. Each row is
+// read as a bitmask of its columns and all the keys in it are
+// debounced together with vertical counters: two bitmasks hold a two
+// bit counter for every key, which counts the scans in a row that the
+// key has read differently from its debounced state. A key only
+// changes state after four such scans, and a single scan that agrees
+// again resets its count. A row that reads the same as its debounced
+// state costs one compare.
+//
+// scan() leaves the keys that changed in that scan in getChanges(), so
+// only edges have to be acted on. HIDMatrix (below) turns them into
+// key presses and releases.
+class HIDMatrixImpl {
+  public:
+
+    // Reader class
+    //
+    // Reads the matrix hardware. readRow() returns a bit set for each
+    // column (bit 0 is column 0) whose switch is closed in that row.
+    class Reader {
+      public:
+        Reader(){}
+        virtual ~Reader(){};
+        virtual uint16_t readRow(uint8_t row) = 0;
+    };
+
+    // keymap_p is rows * cols key codes in program memory, row by row.
+    // A switch is a physical key, so the codes have to be raw keys -
+    // the KEYBOARD_* constants or KEYBOARD_USAGE + usage - and not
+    // characters, which would go through the layout and could add a
+    // Shift. 0 (or any other code below 0x80) means no key.
+    HIDMatrixImpl(Reader* reader_p, uint8_t rows, uint8_t cols,
+                  const uint8_t* keymap_p);
+
+    // Scan every row once. Returns the number of keys that changed.
+    uint8_t scan(void);
+
+    uint16_t getState(uint8_t row) { return state_m[row]; }
+    uint16_t getChanges(uint8_t row) { return changes_m[row]; }
+    bool isPressed(uint8_t row, uint8_t col) {
+        return state_m[row] & (1 << col);
+    }
+    uint8_t getKey(uint8_t row, uint8_t col) {
+        return pgm_read_byte(&keymap_mp[row * cols_m + col]);
+    }
+    uint8_t getRows(void) { return rows_m; }
+    uint8_t getCols(void) { return cols_m; }
+
+    // Number of scans done
+    uint32_t getScanCount(void) { return scans_m; }
+
+  private:
+    Reader*        reader_mp;
+    const uint8_t* keymap_mp;
+    uint8_t        rows_m;
+    uint8_t        cols_m;
+    uint16_t       mask_m;
+    uint32_t       scans_m;
+
+    // Per row: debounced state, counter bits and the last changes
+    uint16_t       state_m[HIDMATRIX_MAX_ROWS];
+    uint16_t       count0_m[HIDMATRIX_MAX_ROWS];
+    uint16_t       count1_m[HIDMATRIX_MAX_ROWS];
+    uint16_t       changes_m[HIDMATRIX_MAX_ROWS];
+};
+
+
+// HIDMatrixPins
+//
+// Reader for a matrix wired straight to pins, with a diode per switch
+// and the columns pulled up. Each row is driven low in turn while the
+// others float. This uses digitalRead() for portability - a reader
+// that reads a whole port at once is much faster.
+class HIDMatrixPins : public HIDMatrixImpl::Reader {
+  public:
+    HIDMatrixPins(const uint8_t* rowPins_p, uint8_t rows,
+                  const uint8_t* colPins_p, uint8_t cols);
+
+    void begin(void);
+    virtual uint16_t readRow(uint8_t row);
+
+  private:
+    const uint8_t* rowPins_mp;
+    const uint8_t* colPins_mp;
+    uint8_t        rows_m;
+    uint8_t        cols_m;
+};
+
+
+// HIDMatrixSim
+//
+// Simulated matrix for testing and benchmarking without hardware -
+// set the closed switches with press()/release() or setRow().
+class HIDMatrixSim : public HIDMatrixImpl::Reader {
+  public:
+    HIDMatrixSim() {
+        memset(rows_m, 0, sizeof(rows_m));
+    }
+
+    void setRow(uint8_t row, uint16_t cols) { rows_m[row] = cols; }
+    void press(uint8_t row, uint8_t col) { rows_m[row] |= 1 << col; }
+    void release(uint8_t row, uint8_t col) { rows_m[row] &= ~(1 << col); }
+
+    virtual uint16_t readRow(uint8_t row) { return rows_m[row]; }
+
+  private:
+    uint16_t rows_m[HIDMATRIX_MAX_ROWS];
+};
+
+
+// HIDMatrix
+//
+// Scans the matrix and passes the changes to the keyboard of a
+// HIDGeneric. All the changes from one scan go in a single transaction,
+// so the host gets at most one report per scan however many keys
+// changed.
+//
+//   typedef HIDGeneric<RN42<typeof Serial3>, HIDKeyboard> HID;
+//   HID hid(rn42Obj);
+//   HIDMatrixPins pins(rowPins, 4, colPins, 12);
+//   HIDMatrix<HID> matrix(hid, &pins, 4, 12, keymap);
+//
+//   void loop() {
+//       matrix.poll();
+//       hid.poll();
+//   }
+template <typename HID>
+class HIDMatrix : public HIDMatrixImpl {
+  public:
+    HIDMatrix(HID& hid, Reader* reader_p, uint8_t rows, uint8_t cols,
+              const uint8_t* keymap_p) :
+        HIDMatrixImpl(reader_p, rows, cols, keymap_p),
+        hid_m(hid) {}
+
+    // Scan once and send the changes. Returns the number of keys that
+    // changed.
+    uint8_t poll(void) {
+        uint8_t n = scan();
+
+        if (!n) {
+            return 0;
+        }
+
+        hid_m.beginTransaction();
+        for (uint8_t row = 0; row < getRows(); row++) {
+            uint16_t changes = getChanges(row);
+            uint16_t state   = getState(row);
+
+            for (uint8_t col = 0; changes; col++, changes >>= 1, state >>= 1) {
+                uint8_t key;
+                if (!(changes & 1) || (key = getKey(row, col)) < 0x80) {
+                    continue;
+                }
+                if (state & 1) {
+                    hid_m.getKeyboard().press(key);
+                }
+                else {
+                    hid_m.getKeyboard().release(key);
+                }
+            }
+        }
+        hid_m.commit();
+        return n;
+    }
+
+  private:
+    HID& hid_m;
+};
+
+
+#endif
+#endif
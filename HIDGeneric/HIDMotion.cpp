@@ -0,0 +1,256 @@
+/*
+** Copyright (c) 2014, Edward Funnekotter
+**
+** Permission to use, copy, modify, and/or distribute this software for
+** any purpose with or without fee is hereby granted, provided that the
+** above copyright notice and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+** WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+** BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+** OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+** WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+** SOFTWARE.
+*/
+
+#include "Arduino.h"
+#include "HIDMotion.h"
+
+
+// Fixed point
+//
+// Positions are in 1/256 pixels. Progress along a path is u, from 0 at
+// the start to U_ONE at the end.
+#define U_SHIFT      15
+#define U_ONE        (1UL << U_SHIFT)
+
+// Velocity is integrated in units of pixels/s * us * 4, of which 15625
+// make 1/256 of a pixel (1000000 * 4 / 256). The time step is limited
+// so that a full scale velocity can't overflow.
+#define VELOCITY_UNIT    15625
+#define VELOCITY_MAX_DT  15000
+
+
+// HIDMotionImpl Methods
+
+HIDMotionImpl::HIDMotionImpl(uint16_t rate) :
+    posX_m(0),
+    posY_m(0),
+    originX_m(0),
+    originY_m(0),
+    sentX_m(0),
+    sentY_m(0),
+    remX_m(0),
+    remY_m(0),
+    type_m(MOTION_NONE),
+    started_m(false),
+    start_m(0),
+    duration_m(0),
+    lastStep_m(0),
+    lastReport_m(0)
+{
+    memset(points_m, 0, sizeof(points_m));
+    setRate(rate);
+}
+
+void
+HIDMotionImpl::setRate(uint16_t rate)
+{
+    interval_m = 1000000UL / (rate ? rate : DEFAULT_RATE);
+}
+
+void
+HIDMotionImpl::start(uint8_t type, uint16_t ms)
+{
+    uint32_t now = micros();
+
+    // Bring the position up to date so that the new motion carries
+    // on from wherever the old one had got to
+    if (type_m != MOTION_NONE) {
+        advance(now);
+    }
+    originX_m  = posX_m;
+    originY_m  = posY_m;
+    remX_m     = 0;
+    remY_m     = 0;
+    type_m     = type;
+    start_m    = now;
+    lastStep_m = now;
+    duration_m = (uint32_t)ms * 1000;
+
+    if (!started_m) {
+        // First report can go straight away
+        lastReport_m = now - interval_m;
+        started_m = true;
+    }
+}
+
+void
+HIDMotionImpl::line(int16_t dx, int16_t dy, uint16_t ms)
+{
+    start(MOTION_LINE, ms);
+    points_m[4] = dx;
+    points_m[5] = dy;
+}
+
+void
+HIDMotionImpl::bezier(
+    int16_t cx1,
+    int16_t cy1,
+    int16_t cx2,
+    int16_t cy2,
+    int16_t dx,
+    int16_t dy,
+    uint16_t ms
+)
+{
+    start(MOTION_BEZIER, ms);
+    points_m[0] = cx1;
+    points_m[1] = cy1;
+    points_m[2] = cx2;
+    points_m[3] = cy2;
+    points_m[4] = dx;
+    points_m[5] = dy;
+}
+
+void
+HIDMotionImpl::velocity(int16_t vx, int16_t vy, uint16_t ms)
+{
+    start(MOTION_VELOCITY, ms);
+    points_m[4] = vx;
+    points_m[5] = vy;
+}
+
+void
+HIDMotionImpl::stop(void)
+{
+    type_m  = MOTION_NONE;
+    posX_m  = (int32_t)sentX_m << 8;
+    posY_m  = (int32_t)sentY_m << 8;
+}
+
+bool
+HIDMotionImpl::isBusy(void)
+{
+    return type_m != MOTION_NONE ||
+        ((posX_m + 128) >> 8) != sentX_m ||
+        ((posY_m + 128) >> 8) != sentY_m;
+}
+
+// Point on the curve from 0 through p1 and p2 to p3 at u, in 1/256
+// pixels:
+//
+//   B(u) = 3(1-u)^2 u p1 + 3(1-u) u^2 p2 + u^3 p3
+//
+// The weights are at most U_ONE and the points 16 bits, so each term
+// fits in 32 bits before it is scaled down.
+int32_t
+HIDMotionImpl::curve(uint16_t u, int16_t p1, int16_t p2, int16_t p3)
+{
+    uint32_t v  = U_ONE - u;
+    uint32_t uu = ((uint32_t)u * u) >> U_SHIFT;
+    uint32_t vv = (v * v) >> U_SHIFT;
+    int32_t  w1 = (int32_t)((3 * vv * u) >> U_SHIFT);
+    int32_t  w2 = (int32_t)((3 * uu * v) >> U_SHIFT);
+    int32_t  w3 = (int32_t)((uu * u) >> U_SHIFT);
+
+    return ((w1 * p1) >> (U_SHIFT - 8)) +
+           ((w2 * p2) >> (U_SHIFT - 8)) +
+           ((w3 * p3) >> (U_SHIFT - 8));
+}
+
+// Move the position on to time now
+void
+HIDMotionImpl::advance(uint32_t now)
+{
+    // A line or curve of no duration goes straight to its end; only a
+    // velocity runs on until the next motion when ms is 0
+    bool     done = duration_m ? now - start_m >= duration_m
+                               : type_m != MOTION_VELOCITY;
+    uint32_t end  = done ? start_m + duration_m : now;
+
+    if (type_m == MOTION_VELOCITY) {
+        uint32_t dt = end - lastStep_m;
+
+        lastStep_m = end;
+        while (dt) {
+            uint32_t part = dt < VELOCITY_MAX_DT ? dt : VELOCITY_MAX_DT;
+            int32_t  x, y;
+
+            remX_m += (int32_t)points_m[4] * (int32_t)(part * 4);
+            remY_m += (int32_t)points_m[5] * (int32_t)(part * 4);
+            x = remX_m / VELOCITY_UNIT;
+            y = remY_m / VELOCITY_UNIT;
+            remX_m -= x * VELOCITY_UNIT;
+            remY_m -= y * VELOCITY_UNIT;
+            posX_m += x;
+            posY_m += y;
+            dt -= part;
+        }
+    }
+    else if (type_m != MOTION_NONE) {
+        uint16_t u;
+
+        if (done) {
+            u = U_ONE;
+        }
+        else {
+            // u = elapsed / duration, scaled down until the division
+            // fits in 32 bits
+            uint32_t e = now - start_m;
+            uint32_t d = duration_m;
+            while (d >= 0x10000UL) {
+                d >>= 1;
+                e >>= 1;
+            }
+            u = (e << U_SHIFT) / d;
+        }
+
+        if (type_m == MOTION_LINE) {
+            posX_m = originX_m + (((int32_t)points_m[4] * u) >> (U_SHIFT - 8));
+            posY_m = originY_m + (((int32_t)points_m[5] * u) >> (U_SHIFT - 8));
+        }
+        else {
+            posX_m = originX_m + curve(u, points_m[0], points_m[2], points_m[4]);
+            posY_m = originY_m + curve(u, points_m[1], points_m[3], points_m[5]);
+        }
+    }
+
+    if (done) {
+        type_m = MOTION_NONE;
+    }
+}
+
+int8_t
+HIDMotionImpl::clamp(int32_t d)
+{
+    return d > 127 ? 127 : d < -127 ? -127 : d;
+}
+
+bool
+HIDMotionImpl::step(uint32_t now, int8_t& x, int8_t& y)
+{
+    if (!started_m || now - lastReport_m < interval_m) {
+        return false;
+    }
+
+    // Keep to the interval, but don't try to catch up on reports that
+    // were missed because poll() wasn't called
+    lastReport_m += interval_m;
+    if (now - lastReport_m >= interval_m) {
+        lastReport_m = now;
+    }
+
+    advance(now);
+
+    x = clamp(((posX_m + 128) >> 8) - sentX_m);
+    y = clamp(((posY_m + 128) >> 8) - sentY_m);
+    if (!x && !y) {
+        return false;
+    }
+    sentX_m += x;
+    sentY_m += y;
+    return true;
+}
@@ -0,0 +1,155 @@
+/*
+** Copyright (c) 2014, Edward Funnekotter
+**
+** Permission to use, copy, modify, and/or distribute this software for
+** any purpose with or without fee is hereby granted, provided that the
+** above copyright notice and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+** WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+** BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+** OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+** WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+** SOFTWARE.
+*/
+
+#ifndef __HIDMOTION_H__
+#define __HIDMOTION_H__
+
+#if defined __cplusplus
+
+#include "Arduino.h"
+#include "HIDGeneric.h"
+
+// HIDMotionImpl
+//
+// Mouse motion engine. A motion is given as a displacement in pixels
+// and a duration - a straight line, a cubic Bezier curve or a constant
+// velocity - and step() works out how far the cursor should have got
+// each time it is called, at most once per report interval. The
+// position is kept in fixed point (8 fractional bits) and each report
+// carries the whole pixels between the last one sent and the current
+// position, so sub-pixel remainders are never lost and a path always
+// ends exactly where it should. Everything owed since the last report
+// goes into the next one, so there is at most one report per interval
+// and none when the cursor hasn't moved a whole pixel. Moves larger
+// than a report can hold are spread over the following reports.
+//
+// Starting a motion while another is running abandons the rest of the
+// old one; the new one starts wherever the old one had got to.
+//
+// The motion is driven by HIDMotion (below), which sends the reports
+// through a mouse.
+class HIDMotionImpl {
+  public:
+
+    // Default report rate (Hz)
+    static const uint16_t DEFAULT_RATE = 125;
+
+    HIDMotionImpl(uint16_t rate);
+
+    void setRate(uint16_t rate);
+
+    // Straight line by (dx, dy) pixels over ms milliseconds (0 goes
+    // there as fast as the reports allow)
+    void line(int16_t dx, int16_t dy, uint16_t ms);
+
+    // Cubic Bezier curve to (dx, dy) with the control points
+    // (cx1, cy1) and (cx2, cy2), all relative to the starting point
+    void bezier(int16_t cx1, int16_t cy1, int16_t cx2, int16_t cy2,
+                int16_t dx, int16_t dy, uint16_t ms);
+
+    // Constant velocity in pixels per second, for ms milliseconds or
+    // until the next motion if ms is 0
+    void velocity(int16_t vx, int16_t vy, uint16_t ms = 0);
+
+    // Stop where the cursor is now - anything not yet sent is dropped
+    void stop(void);
+
+    // True while there is still something to send
+    bool isBusy(void);
+
+  protected:
+
+    // Advance to time now (micros()). Returns true with the movement
+    // for the next report if one is due.
+    bool step(uint32_t now, int8_t& x, int8_t& y);
+
+  private:
+
+    static const uint8_t MOTION_NONE     = 0;
+    static const uint8_t MOTION_LINE     = 1;
+    static const uint8_t MOTION_BEZIER   = 2;
+    static const uint8_t MOTION_VELOCITY = 3;
+
+    void start(uint8_t type, uint16_t ms);
+    void advance(uint32_t now);
+    static int32_t curve(uint16_t u, int16_t p1, int16_t p2, int16_t p3);
+    static int8_t clamp(int32_t d);
+
+    // Current position and the start of the motion in 1/256 pixels,
+    // and what has been sent so far in whole pixels
+    int32_t   posX_m;
+    int32_t   posY_m;
+    int32_t   originX_m;
+    int32_t   originY_m;
+    int32_t   sentX_m;
+    int32_t   sentY_m;
+
+    // Control points (pixels), or the velocity in pixels per second
+    int16_t   points_m[6];
+
+    // Velocity remainders, in 1/256 pixel / 15625 units
+    int32_t   remX_m;
+    int32_t   remY_m;
+
+    uint8_t   type_m;
+    bool      started_m;
+    uint32_t  start_m;
+    uint32_t  duration_m;
+    uint32_t  lastStep_m;
+    uint32_t  lastReport_m;
+    uint32_t  interval_m;
+};
+
+
+// HIDMotion
+//
+// Drives HIDMotionImpl through a mouse device. poll() never waits -
+// call it from the main loop as often as possible.
+//
+//   typedef HIDGeneric<RN42<typeof Serial3> > HID;
+//   HID hid(rn42Obj);
+//   HIDMotion<HID::Mouse> motion(hid.getMouse());
+//
+//   motion.line(200, -50, 500);
+//   while (motion.isBusy()) {
+//       motion.poll();
+//   }
+template <typename MouseClass>
+class HIDMotion : public HIDMotionImpl {
+  public:
+    HIDMotion(MouseClass& mouse, uint16_t rate = DEFAULT_RATE) :
+        HIDMotionImpl(rate),
+        mouse_m(mouse) {}
+
+    // Returns true if a report was sent
+    bool poll(void) {
+        int8_t x, y;
+
+        if (!step(micros(), x, y)) {
+            return false;
+        }
+        mouse_m.move(x, y);
+        return true;
+    }
+
+  private:
+    MouseClass& mouse_m;
+};
+
+
+#endif
+#endif
@@ -0,0 +1,562 @@
+/*
+** Copyright (c) 2014, Edward Funnekotter
+**
+** Permission to use, copy, modify, and/or distribute this software for
+** any purpose with or without fee is hereby granted, provided that the
+** above copyright notice and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+** WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+** BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+** OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+** WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+** SOFTWARE.
+*/
+
+#include "Arduino.h"
+#include "HIDReport.h"
+
+// Short item prefix: tag in the top four bits, type in the next two
+// and the data size (0, 1, 2 or 4 bytes) in the bottom two
+#define ITEM_TYPE(p)     (((p) >> 2) & 3)
+#define ITEM_TAG(p)      ((p) >> 4)
+#define ITEM_LONG        0xfe
+
+#define TYPE_MAIN        0
+#define TYPE_GLOBAL      1
+#define TYPE_LOCAL       2
+
+#define MAIN_INPUT       0x8
+#define MAIN_OUTPUT      0x9
+#define MAIN_FEATURE     0xb
+
+#define GLOBAL_USAGE_PAGE   0x0
+#define GLOBAL_LOGICAL_MIN  0x1
+#define GLOBAL_LOGICAL_MAX  0x2
+#define GLOBAL_REPORT_SIZE  0x7
+#define GLOBAL_REPORT_ID    0x8
+#define GLOBAL_REPORT_COUNT 0x9
+#define GLOBAL_PUSH         0xa
+#define GLOBAL_POP          0xb
+
+#define LOCAL_USAGE      0x0
+#define LOCAL_USAGE_MIN  0x1
+#define LOCAL_USAGE_MAX  0x2
+
+// Main item data bits
+#define DATA_CONSTANT    0x01
+#define DATA_VARIABLE    0x02
+#define DATA_RELATIVE    0x04
+#define DATA_NULL        0x40
+
+
+// HIDReportMap Methods
+
+HIDReportMap::HIDReportMap() :
+    fieldCount_m(0),
+    reportCount_m(0)
+{
+}
+
+// Bits used so far in a report, added to the table the first time
+uint16_t*
+HIDReportMap::reportBits(uint8_t reportId, uint8_t type)
+{
+    for (uint8_t i = 0; i < reportCount_m; i++) {
+        if (reports_m[i].reportId == reportId && reports_m[i].type == type) {
+            return &reports_m[i].bits;
+        }
+    }
+    if (reportCount_m == HIDREPORT_MAX_REPORTS) {
+        return 0;
+    }
+    Report& r = reports_m[reportCount_m++];
+    r.reportId = reportId;
+    r.type     = type;
+    r.bits     = 0;
+    return &r.bits;
+}
+
+bool
+HIDReportMap::addField(const Field& field)
+{
+    if (fieldCount_m == HIDREPORT_MAX_FIELDS) {
+        return false;
+    }
+    fields_m[fieldCount_m++] = field;
+    return true;
+}
+
+bool
+HIDReportMap::parse(const uint8_t* descriptor_p, uint16_t size)
+{
+    // Global items, and one level of push/pop
+    typedef struct {
+        uint16_t usagePage;
+        int32_t  logicalMin;
+        int32_t  logicalMax;
+        uint32_t reportSize;                   // full width until checked
+        uint32_t reportCount;
+        uint8_t  reportId;
+    } Globals;
+
+    Globals g;
+    Globals pushed;
+    bool    isPushed = false;
+
+    // Local items - usages, or a usage range, with their pages
+    uint16_t usages[HIDREPORT_MAX_USAGES];
+    uint16_t pages[HIDREPORT_MAX_USAGES];
+    uint8_t  usageCount = 0;
+    uint16_t usageMin = 0;
+    uint16_t usageMax = 0;
+    bool     isRange = false;
+
+    memset(&g, 0, sizeof(g));
+    fieldCount_m  = 0;
+    reportCount_m = 0;
+
+    uint16_t i = 0;
+    while (i < size) {
+        uint8_t prefix = pgm_read_byte(&descriptor_p[i++]);
+
+        if (prefix == ITEM_LONG) {
+            if (i + 2 > size) {
+                return false;
+            }
+            i += 2 + pgm_read_byte(&descriptor_p[i]);
+            continue;
+        }
+
+        uint8_t  len = prefix & 3;
+        uint32_t value = 0;
+        int32_t  svalue;
+
+        if (len == 3) {
+            len = 4;
+        }
+        if (i + len > size) {
+            return false;
+        }
+        for (uint8_t b = 0; b < len; b++) {
+            value |= (uint32_t)pgm_read_byte(&descriptor_p[i++]) << (b * 8);
+        }
+
+        // Signed reading of the same data
+        if (len == 1) {
+            svalue = (int8_t)value;
+        }
+        else if (len == 2) {
+            svalue = (int16_t)value;
+        }
+        else {
+            svalue = value;
+        }
+
+        switch (ITEM_TYPE(prefix)) {
+          case TYPE_MAIN: {
+            uint8_t tag  = ITEM_TAG(prefix);
+            uint8_t type = tag == MAIN_INPUT ? REPORT_INPUT :
+                           tag == MAIN_OUTPUT ? REPORT_OUTPUT :
+                           tag == MAIN_FEATURE ? REPORT_FEATURE : 0xff;
+
+            if (type != 0xff) {
+                uint16_t* bits_p = reportBits(g.reportId, type);
+                if (!bits_p || g.reportCount > 255 || g.reportSize > 32) {
+                    return false;
+                }
+                // Report lengths are kept in a byte
+                if (*bits_p + g.reportSize * g.reportCount > 255 * 8) {
+                    return false;
+                }
+
+                if (!(value & DATA_CONSTANT) && g.reportCount && g.reportSize) {
+                    Field f;
+                    f.reportId   = g.reportId;
+                    f.flags      = type;
+                    f.bitOffset  = *bits_p;
+                    f.size       = g.reportSize;
+                    f.usagePage  = g.usagePage;
+                    f.logicalMin = g.logicalMin;
+                    f.logicalMax = g.logicalMax;
+                    if (value & DATA_RELATIVE) {
+                        f.flags |= FIELD_RELATIVE;
+                    }
+                    if (value & DATA_NULL) {
+                        f.flags |= FIELD_NULL;
+                    }
+                    if (g.logicalMin < 0) {
+                        f.flags |= FIELD_SIGNED;
+                    }
+
+                    if (!(value & DATA_VARIABLE)) {
+                        // Array - one field for the whole usage range
+                        f.count = g.reportCount;
+                        if (isRange) {
+                            f.usage    = usageMin;
+                            f.usageMax = usageMax;
+                        }
+                        else {
+                            f.usage    = usageCount ? usages[0] : 0;
+                            f.usageMax = usageCount ? usages[usageCount - 1] : 0;
+                            if (usageCount) {
+                                f.usagePage = pages[0];
+                            }
+                        }
+                        if (!addField(f)) {
+                            return false;
+                        }
+                    }
+                    else {
+                        // Variable - one field per run of consecutive
+                        // usages. The last usage repeats if there are
+                        // fewer usages than elements.
+                        f.flags |= FIELD_VARIABLE;
+                        f.count = 0;
+                        for (uint8_t e = 0; e < g.reportCount; e++) {
+                            uint16_t usage;
+                            uint16_t page = g.usagePage;
+
+                            if (isRange) {
+                                usage = usageMin + e;
+                                if (usage > usageMax) {
+                                    usage = usageMax;
+                                }
+                            }
+                            else if (usageCount) {
+                                uint8_t u = e < usageCount ? e : usageCount - 1;
+                                usage = usages[u];
+                                page  = pages[u];
+                            }
+                            else {
+                                usage = 0;
+                            }
+
+                            if (f.count && page == f.usagePage &&
+                                usage == f.usageMax + 1) {
+                                f.count++;
+                                f.usageMax = usage;
+                                continue;
+                            }
+                            if (f.count && !addField(f)) {
+                                return false;
+                            }
+                            f.bitOffset = *bits_p + e * g.reportSize;
+                            f.count     = 1;
+                            f.usagePage = page;
+                            f.usage     = usage;
+                            f.usageMax  = usage;
+                        }
+                        if (!addField(f)) {
+                            return false;
+                        }
+                    }
+                }
+                *bits_p += g.reportSize * g.reportCount;
+            }
+
+            // Locals only last until the next main item
+            usageCount = 0;
+            isRange = false;
+            break;
+          }
+
+          case TYPE_GLOBAL:
+            switch (ITEM_TAG(prefix)) {
+              case GLOBAL_USAGE_PAGE:
+                g.usagePage = value;
+                break;
+              case GLOBAL_LOGICAL_MIN:
+                g.logicalMin = svalue;
+                break;
+              case GLOBAL_LOGICAL_MAX:
+                // Commonly written unsigned, e.g. 255 as 0xff
+                g.logicalMax = svalue < g.logicalMin ? (int32_t)value : svalue;
+                break;
+              case GLOBAL_REPORT_SIZE:
+                g.reportSize = value;
+                break;
+              case GLOBAL_REPORT_ID:
+                if (value > 255) {
+                    return false;
+                }
+                g.reportId = value;
+                break;
+              case GLOBAL_REPORT_COUNT:
+                g.reportCount = value;
+                break;
+              case GLOBAL_PUSH:
+                if (isPushed) {
+                    return false;
+                }
+                pushed = g;
+                isPushed = true;
+                break;
+              case GLOBAL_POP:
+                if (!isPushed) {
+                    return false;
+                }
+                g = pushed;
+                isPushed = false;
+                break;
+            }
+            break;
+
+          case TYPE_LOCAL:
+            switch (ITEM_TAG(prefix)) {
+              case LOCAL_USAGE:
+                if (usageCount == HIDREPORT_MAX_USAGES) {
+                    return false;
+                }
+                // A four byte usage carries its own page
+                pages[usageCount]  = len == 4 ? value >> 16 : g.usagePage;
+                usages[usageCount] = value;
+                usageCount++;
+                break;
+              case LOCAL_USAGE_MIN:
+                usageMin = value;
+                isRange = true;
+                break;
+              case LOCAL_USAGE_MAX:
+                usageMax = value;
+                isRange = true;
+                break;
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+int8_t
+HIDReportMap::find(
+    uint8_t reportId,
+    uint8_t type,
+    uint16_t usagePage,
+    uint16_t usage,
+    uint8_t* index_p
+)
+{
+    for (uint8_t i = 0; i < fieldCount_m; i++) {
+        const Field& f = fields_m[i];
+        if (f.reportId != reportId || (f.flags & FIELD_TYPE) != type ||
+            f.usagePage != usagePage || usage < f.usage || usage > f.usageMax) {
+            continue;
+        }
+        if (index_p) {
+            *index_p = (f.flags & FIELD_VARIABLE) ? usage - f.usage : 0;
+        }
+        return i;
+    }
+    return -1;
+}
+
+uint8_t
+HIDReportMap::getReportLength(uint8_t reportId, uint8_t type)
+{
+    for (uint8_t i = 0; i < reportCount_m; i++) {
+        if (reports_m[i].reportId == reportId && reports_m[i].type == type) {
+            return (reports_m[i].bits + 7) / 8;
+        }
+    }
+    return 0;
+}
+
+void
+HIDReportMap::set(uint8_t* report_p, uint8_t field, uint8_t index, int32_t value)
+{
+    const Field& f = fields_m[field];
+
+    if (!(f.flags & FIELD_NULL)) {
+        if (value < f.logicalMin) {
+            value = f.logicalMin;
+        }
+        else if (value > f.logicalMax) {
+            value = f.logicalMax;
+        }
+    }
+    pack(report_p, f.bitOffset + index * f.size, f.size, value);
+}
+
+int32_t
+HIDReportMap::get(const uint8_t* report_p, uint8_t field, uint8_t index)
+{
+    const Field& f = fields_m[field];
+    uint32_t value = unpack(report_p, f.bitOffset + index * f.size, f.size);
+
+    // Sign extend
+    if ((f.flags & FIELD_SIGNED) && f.size < 32 && (value >> (f.size - 1)) & 1) {
+        value |= ~(uint32_t)0 << f.size;
+    }
+    return value;
+}
+
+// Byte aligned fields, which most are, are copied a byte at a time;
+// anything else goes through a mask for each byte it touches.
+void
+HIDReportMap::pack(uint8_t* buf_p, uint16_t bitOffset, uint8_t size, uint32_t value)
+{
+    uint8_t* p = buf_p + (bitOffset >> 3);
+    uint8_t  shift = bitOffset & 7;
+
+    if (!shift) {
+        for (; size >= 8; size -= 8) {
+            *p++ = value;
+            value >>= 8;
+        }
+        if (!size) {
+            return;
+        }
+    }
+
+    while (size) {
+        uint8_t bits = 8 - shift;
+        if (bits > size) {
+            bits = size;
+        }
+        uint8_t mask = ((1 << bits) - 1) << shift;
+        *p = (*p & ~mask) | ((value << shift) & mask);
+        p++;
+        value >>= bits;
+        size -= bits;
+        shift = 0;
+    }
+}
+
+uint32_t
+HIDReportMap::unpack(const uint8_t* buf_p, uint16_t bitOffset, uint8_t size)
+{
+    const uint8_t* p = buf_p + (bitOffset >> 3);
+    uint8_t  shift = bitOffset & 7;
+    uint8_t  got = 0;
+    uint32_t value = 0;
+
+    while (got < size) {
+        uint8_t bits = 8 - shift;
+        if (bits > size - got) {
+            bits = size - got;
+        }
+        value |= (uint32_t)((*p++ >> shift) & ((1 << bits) - 1)) << got;
+        got += bits;
+        shift = 0;
+    }
+    return value;
+}
+
+
+// HIDReport Methods
+
+HIDReport::HIDReport(HIDReportMap& map, uint8_t reportId, uint8_t type) :
+    map_m(map),
+    reportId_m(reportId),
+    type_m(type)
+{
+    length_m = map.getReportLength(reportId, type);
+    if (length_m > HIDREPORT_MAX_SIZE) {
+        // Too long for the buffer - treat it as a report with no fields
+        length_m = 0;
+    }
+    clear();
+}
+
+// Field of the report holding a usage, or -1. Every field of a report
+// lies within its length, so once the length has been checked here the
+// field can be packed without further bounds checks.
+int8_t
+HIDReport::find(uint16_t usagePage, uint16_t usage, uint8_t* index_p)
+{
+    if (!length_m) {
+        return -1;
+    }
+    return map_m.find(reportId_m, type_m, usagePage, usage, index_p);
+}
+
+bool
+HIDReport::set(uint16_t usagePage, uint16_t usage, int32_t value)
+{
+    uint8_t index;
+    int8_t  field = find(usagePage, usage, &index);
+
+    if (field < 0 || !(map_m.getField(field).flags & HIDReportMap::FIELD_VARIABLE)) {
+        return false;
+    }
+    map_m.set(data_m, field, index, value);
+    return true;
+}
+
+bool
+HIDReport::get(uint16_t usagePage, uint16_t usage, int32_t* value_p)
+{
+    uint8_t index;
+    int8_t  field = find(usagePage, usage, &index);
+
+    if (field < 0 || !(map_m.getField(field).flags & HIDReportMap::FIELD_VARIABLE)) {
+        return false;
+    }
+    *value_p = map_m.get(data_m, field, index);
+    return true;
+}
+
+// An array element holds the index of its usage in the field's usage
+// range, offset by the logical minimum. Zero is taken as an empty
+// element.
+bool
+HIDReport::press(uint16_t usagePage, uint16_t usage)
+{
+    uint8_t index;
+    int8_t  field = find(usagePage, usage, &index);
+
+    if (field < 0) {
+        return false;
+    }
+
+    const HIDReportMap::Field& f = map_m.getField(field);
+    if (f.flags & HIDReportMap::FIELD_VARIABLE) {
+        map_m.set(data_m, field, index, f.logicalMax);
+        return true;
+    }
+
+    int32_t code = usage - f.usage + f.logicalMin;
+    int8_t  free = -1;
+    for (uint8_t e = 0; e < f.count; e++) {
+        int32_t v = map_m.get(data_m, field, e);
+        if (v == code) {
+            return true;
+        }
+        if (!v && free < 0) {
+            free = e;
+        }
+    }
+    if (free < 0) {
+        return false;
+    }
+    map_m.set(data_m, field, free, code);
+    return true;
+}
+
+bool
+HIDReport::release(uint16_t usagePage, uint16_t usage)
+{
+    uint8_t index;
+    int8_t  field = find(usagePage, usage, &index);
+
+    if (field < 0) {
+        return false;
+    }
+
+    const HIDReportMap::Field& f = map_m.getField(field);
+    if (f.flags & HIDReportMap::FIELD_VARIABLE) {
+        map_m.set(data_m, field, index, f.logicalMin);
+        return true;
+    }
+
+    int32_t code = usage - f.usage + f.logicalMin;
+    for (uint8_t e = 0; e < f.count; e++) {
+        if (map_m.get(data_m, field, e) == code) {
+            HIDReportMap::pack(data_m, f.bitOffset + e * f.size, f.size, 0);
+        }
+    }
+    return true;
+}
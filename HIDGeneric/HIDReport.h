@@ -0,0 +1,194 @@
+/*
+** Copyright (c) 2014, Edward Funnekotter
+**
+** Permission to use, copy, modify, and/or distribute this software for
+** any purpose with or without fee is hereby granted, provided that the
+** above copyright notice and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+** WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+** BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+** OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+** WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+** SOFTWARE.
+*/
+
+#ifndef __HIDREPORT_H__
+#define __HIDREPORT_H__
+
+#if defined __cplusplus
+
+#include "Arduino.h"
+#include "HIDGeneric.h"
+
+// Size of the tables filled in by HIDReportMap::parse(). A field is
+// 20 bytes, so these are kept small.
+#ifndef HIDREPORT_MAX_FIELDS
+#define HIDREPORT_MAX_FIELDS 16
+#endif
+#ifndef HIDREPORT_MAX_REPORTS
+#define HIDREPORT_MAX_REPORTS 8
+#endif
+#ifndef HIDREPORT_MAX_USAGES
+#define HIDREPORT_MAX_USAGES 8
+#endif
+
+// Largest report HIDReport can hold, not counting the report ID. The
+// default is 16 bytes, or more if that is what it takes to hold every
+// built-in report - the gamepad's is 17 bytes with 16 bit axes.
+#ifndef HIDREPORT_MAX_SIZE
+#define HIDREPORT_MAX_SIZE \
+    (HIDGenericImpl::Gamepad::REPORT_SIZE > 16 ? HIDGenericImpl::Gamepad::REPORT_SIZE : 16)
+#endif
+
+// HIDReportMap
+//
+// Parses a report descriptor once and keeps a table of the data fields
+// in it: where each one is in its report (bit offset, size and count),
+// its usages and its logical range. Reports can then be packed and
+// unpacked by usage, so a device only needs its descriptor and no
+// packing code of its own.
+//
+// Variable items are split into one field per run of consecutive
+// usages (X and Y are one field, a Wheel after them another). An array
+// item is one field covering its usage range. Constant (padding) items
+// only move the offset along.
+//
+// Bit offsets don't include the report ID byte, matching the data
+// passed to HIDGenericImpl::sendReport().
+class HIDReportMap {
+  public:
+
+    // Report types
+    static const uint8_t REPORT_INPUT   = 0;
+    static const uint8_t REPORT_OUTPUT  = 1;
+    static const uint8_t REPORT_FEATURE = 2;
+
+    // Field flags
+    static const uint8_t FIELD_TYPE     = 0x03;  // REPORT_INPUT, _OUTPUT or _FEATURE
+    static const uint8_t FIELD_VARIABLE = 0x04;
+    static const uint8_t FIELD_RELATIVE = 0x08;
+    static const uint8_t FIELD_SIGNED   = 0x10;
+    static const uint8_t FIELD_NULL     = 0x20;  // out of range is "no value"
+
+    typedef struct {
+        uint8_t  reportId;
+        uint8_t  flags;
+        uint16_t bitOffset;
+        uint8_t  size;                         // bits per element
+        uint8_t  count;                        // elements
+        uint16_t usagePage;
+        uint16_t usage;                        // usage of element 0 / minimum
+        uint16_t usageMax;                     // last usage
+        int32_t  logicalMin;
+        int32_t  logicalMax;
+    } Field;
+
+    HIDReportMap();
+
+    // Parse a descriptor in program memory. Returns false if it is
+    // malformed or doesn't fit in the tables; what was parsed up to
+    // that point is kept.
+    bool parse(const uint8_t* descriptor_p, uint16_t size);
+
+    uint8_t getFieldCount(void) { return fieldCount_m; }
+    const Field& getField(uint8_t i) { return fields_m[i]; }
+
+    // Find the field of a report holding a usage. Returns the field
+    // number or -1. For a variable field *index_p is set to the element
+    // of the usage.
+    int8_t find(uint8_t reportId, uint8_t type, uint16_t usagePage,
+                uint16_t usage, uint8_t* index_p = 0);
+
+    // Length in bytes of a report, not counting the report ID, or 0 if
+    // there is no such report. parse() refuses reports over 255 bytes.
+    uint8_t getReportLength(uint8_t reportId, uint8_t type = REPORT_INPUT);
+
+    // Set or get element index of a field in a report buffer. set()
+    // limits the value to the field's logical range, unless the field
+    // has a null state (e.g. a centred hat switch) where anything
+    // outside it is stored as given.
+    void set(uint8_t* report_p, uint8_t field, uint8_t index, int32_t value);
+    int32_t get(const uint8_t* report_p, uint8_t field, uint8_t index);
+
+    // Raw bit packing - size is 1 to 32 bits
+    static void pack(uint8_t* buf_p, uint16_t bitOffset, uint8_t size, uint32_t value);
+    static uint32_t unpack(const uint8_t* buf_p, uint16_t bitOffset, uint8_t size);
+
+  private:
+    typedef struct {
+        uint8_t  reportId;
+        uint8_t  type;
+        uint16_t bits;
+    } Report;
+
+    uint16_t* reportBits(uint8_t reportId, uint8_t type);
+    bool addField(const Field& field);
+
+    Field    fields_m[HIDREPORT_MAX_FIELDS];
+    Report   reports_m[HIDREPORT_MAX_REPORTS];
+    uint8_t  fieldCount_m;
+    uint8_t  reportCount_m;
+};
+
+
+// HIDReport
+//
+// A buffer for one report, filled in by usage through a HIDReportMap
+// and sent with a HIDGeneric (or HIDGenericImpl).
+//
+//   HIDReportMap map;
+//   map.parse(descriptor, sizeof(descriptor));
+//   HIDReport joystick(map, 5);
+//   joystick.set(0x01, 0x30, x);              // Generic Desktop X
+//   joystick.press(0x09, 3);                  // Button 3
+//   joystick.send(hid);
+//
+// A report longer than HIDREPORT_MAX_SIZE can't be held: getLength()
+// is 0, set(), press() and the rest return false and send() does
+// nothing.
+class HIDReport {
+  public:
+    HIDReport(HIDReportMap& map, uint8_t reportId,
+              uint8_t type = HIDReportMap::REPORT_INPUT);
+
+    // Set or get the value of a variable usage. Return false if the
+    // report has no such usage.
+    bool set(uint16_t usagePage, uint16_t usage, int32_t value);
+    bool get(uint16_t usagePage, uint16_t usage, int32_t* value_p);
+
+    // Press and release a usage. For a variable usage (e.g. a button)
+    // this sets it to its logical maximum or minimum; for an array
+    // usage (e.g. a key) it is added to or removed from the array.
+    bool press(uint16_t usagePage, uint16_t usage);
+    bool release(uint16_t usagePage, uint16_t usage);
+
+    void clear(void) { memset(data_m, 0, sizeof(data_m)); }
+
+    template <typename HID>
+    void send(HID& hid) {
+        if (length_m) {
+            hid.sendReport(reportId_m, data_m, length_m);
+        }
+    }
+
+    // Report without the ID, and for unpacking a received report
+    uint8_t* getData(void) { return data_m; }
+    uint8_t getLength(void) { return length_m; }
+    uint8_t getReportId(void) { return reportId_m; }
+
+  private:
+    int8_t find(uint16_t usagePage, uint16_t usage, uint8_t* index_p);
+
+    HIDReportMap& map_m;
+    uint8_t       reportId_m;
+    uint8_t       type_m;
+    uint8_t       length_m;
+    uint8_t       data_m[HIDREPORT_MAX_SIZE];
+};
+
+
+#endif
+#endif
@@ -0,0 +1,219 @@
+// CycleBenchmark
+//
+// Cycle counts and stack use of the hot paths on an AVR, for tracking
+// from one commit to the next. It is meant to be run in simavr by
+// extras/simavr/bench.sh, which builds it for the ATmega328P and
+// collects the results, but works the same on a real board.
+//
+// For each benchmark the call is made RUNS times and the average is
+// printed, less the cost of calling an empty function the same way.
+// Timer1 counts CPU cycles with its overflow interrupt extending the
+// count to 32 bits, so calls that wait on the UART are measured
+// correctly too. The millis() interrupt is off while measuring.
+//
+// Stack use is found by filling the free RAM below the stack with a
+// pattern before the call and looking for the lowest byte changed
+// afterwards. It includes any interrupt taken during the call.
+//
+// Everything is printed as key=value lines (as rn42emu does), and
+// "done=1" at the end, after which the CPU is put to sleep with
+// interrupts off so that simavr exits.
+//
+// The 32U4 has no UART on Serial (it is USB), so the results go out
+// on Serial1 there. Its core starts the USB device at power up, which
+// simavr doesn't emulate fully, so on that chip use a real board.
+//
+// rn42_send_report is the frame written to the UART. It must be built
+// without RN42_DEBUG, or it would time the debug echo instead.
+
+#if !defined(__AVR__)
+#error "CycleBenchmark needs an AVR board"
+#endif
+
+#include <avr/sleep.h>
+#include <HIDGeneric.h>
+#include <RN42.h>
+
+#ifdef RN42_DEBUG
+#error "CycleBenchmark has to be built without RN42_DEBUG"
+#endif
+
+#if defined(UBRR1H) && !defined(UBRR0H)
+#define BENCH_SERIAL Serial1
+#else
+#define BENCH_SERIAL Serial
+#endif
+
+static const uint16_t RUNS = 32;
+
+// Transport and stream that throw everything away
+class NullTransport {
+public:
+    void sendReport(const void* data, uint32_t len) {}
+    void sendControl(uint8_t flags, const void* data, uint32_t len) {}
+    int receiveReport(void* data, uint32_t len) { return 0; }
+};
+
+class NullStream {
+public:
+    size_t write(uint8_t c) { return 1; }
+    int available() { return 0; }
+    int read() { return -1; }
+};
+
+NullTransport null;
+typedef HIDGeneric<NullTransport> HID;
+HID hid(null);
+
+NullStream nullStream;
+RN42<NullStream> rn42(nullStream);
+
+
+// Cycle counter
+
+static volatile uint16_t overflows;
+
+ISR(TIMER1_OVF_vect)
+{
+    overflows++;
+}
+
+static void startTimer() {
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+    TIMSK1 = _BV(TOIE1);
+}
+
+static uint32_t now() {
+    uint8_t  sreg = SREG;
+    cli();
+    uint16_t low  = TCNT1;
+    uint16_t high = overflows;
+    // An overflow that hasn't been serviced yet
+    if ((TIFR1 & _BV(TOV1)) && low < 0x8000) {
+        high++;
+    }
+    SREG = sreg;
+    return ((uint32_t)high << 16) | low;
+}
+
+
+// Stack painting
+
+extern uint8_t __heap_start;
+extern void*   __brkval;
+
+static const uint8_t PAINT = 0xa5;
+
+static uint8_t* freeBottom() {
+    return __brkval ? (uint8_t*)__brkval : &__heap_start;
+}
+
+static void __attribute__((noinline)) paintStack() {
+    uint8_t* top = (uint8_t*)SP - 16;
+    for (uint8_t* p = freeBottom(); p < top; p++) {
+        *p = PAINT;
+    }
+}
+
+static uint16_t stackUsed(uint8_t* base) {
+    uint8_t* p = freeBottom();
+    while (p < base && *p == PAINT) {
+        p++;
+    }
+    return base - p;
+}
+
+
+// Benchmarks - each one is a call to time, with an untimed call before
+// it to put things back the way they were
+
+static uint8_t mouseReport[4] = { 0, 1, 0xff, 0 };
+static uint8_t rn42Report[5]  = { HIDGenericImpl::MOUSE_REPORT_ID, 0, 1, 0xff, 0 };
+
+static void nothing() {}
+static void releaseAll() { hid.getKeyboard().releaseAll(); }
+static void pressA() { hid.getKeyboard().press('a'); }
+static void releaseA() { hid.getKeyboard().release('a'); }
+static void pressShifted() { hid.getKeyboard().press('A'); }
+static void writeA() { hid.getKeyboard().write('a'); }
+static void move() { hid.getMouse().move(1, -1); }
+static void sendReport() {
+    hid.sendReport(HIDGenericImpl::MOUSE_REPORT_ID, mouseReport, sizeof(mouseReport));
+}
+static void rn42SendReport() { rn42.sendReport(rn42Report, sizeof(rn42Report)); }
+
+static uint32_t overhead;
+
+static void print(const char* name, const char* what, uint32_t value) {
+    BENCH_SERIAL.print(name);
+    BENCH_SERIAL.print('.');
+    BENCH_SERIAL.print(what);
+    BENCH_SERIAL.print('=');
+    BENCH_SERIAL.println(value);
+}
+
+static uint32_t measure(const char* name, void (*run)(), void (*prepare)()) {
+    uint32_t total = 0;
+    uint16_t stack = 0;
+
+    // Nothing of ours left to send while timing
+    BENCH_SERIAL.flush();
+
+    for (uint16_t i = 0; i < RUNS; i++) {
+        prepare();
+        uint8_t* base = (uint8_t*)SP;
+        paintStack();
+        uint32_t t0 = now();
+        run();
+        uint32_t t1 = now();
+        total += t1 - t0;
+        uint16_t used = stackUsed(base);
+        if (used > stack) {
+            stack = used;
+        }
+    }
+    total /= RUNS;
+    if (name) {
+        print(name, "cycles", total > overhead ? total - overhead : 0);
+        print(name, "stack", stack);
+    }
+    return total;
+}
+
+#define SIZE(type) print("sizeof", #type, sizeof(type))
+
+void setup() {
+    BENCH_SERIAL.begin(115200);
+    hid.begin();
+
+    // No millis() interrupt while measuring
+    TIMSK0 = 0;
+    startTimer();
+    overhead = measure(0, nothing, nothing);
+    print("overhead", "cycles", overhead);
+
+    measure("keyboard_press", pressA, releaseAll);
+    measure("keyboard_press_shifted", pressShifted, releaseAll);
+    measure("keyboard_release", releaseA, pressA);
+    measure("keyboard_write", writeA, nothing);
+    measure("mouse_move", move, nothing);
+    measure("hid_send_report", sendReport, nothing);
+    measure("rn42_send_report", rn42SendReport, nothing);
+
+    SIZE(HIDGenericImpl);
+    SIZE(HIDGenericImpl::Mouse);
+    SIZE(HIDGenericImpl::Keyboard);
+    SIZE(HID);
+    SIZE(RN42<NullStream>);
+
+    BENCH_SERIAL.println("done=1");
+    BENCH_SERIAL.flush();
+
+    cli();
+    sleep_enable();
+    sleep_cpu();
+}
+
+void loop() {
+}
@@ -0,0 +1,66 @@
+// Footprint
+//
+// Builds HIDGeneric with one of the device lists below so that the
+// flash and RAM use of each can be read off the size report printed
+// by the IDE (or avr-size) at the end of the build. Change
+// DEVICES and rebuild to compare, or run extras/simavr/footprint.sh
+// to build all of them and print the sizes.
+//
+//   0 - mouse and keyboard (the default list)
+//   1 - keyboard only
+//   2 - mouse only
+//   3 - consumer control only
+//   4 - gamepad only
+//
+// The RN-42 profiles don't carry the gamepad report, so 4 is only
+// good for the size; its reports are dropped by RN42::sendReport.
+
+#include <HIDGeneric.h>
+#include <RN42.h>
+
+#ifndef DEVICES
+#define DEVICES 0
+#endif
+
+#if DEVICES == 0
+typedef HIDGeneric<RN42<typeof Serial> >                HID;
+#elif DEVICES == 1
+typedef HIDGeneric<RN42<typeof Serial>, HIDKeyboard>    HID;
+#elif DEVICES == 2
+typedef HIDGeneric<RN42<typeof Serial>, HIDMouse>       HID;
+#elif DEVICES == 3
+typedef HIDGeneric<RN42<typeof Serial>, HIDConsumerControl> HID;
+#elif DEVICES == 4
+typedef HIDGeneric<RN42<typeof Serial>, HIDGamepad>     HID;
+#else
+#error DEVICES must be 0 to 4
+#endif
+
+RN42<typeof Serial> rn42(Serial);
+HID hid(rn42);
+
+void setup() {
+    Serial.begin(115200);
+    rn42.begin(115200);
+    hid.begin();
+}
+
+void loop() {
+    hid.poll();
+#if DEVICES == 0 || DEVICES == 1
+    hid.getKeyboard().write('a');
+#endif
+#if DEVICES == 0 || DEVICES == 2
+    hid.getMouse().move(1, 0);
+#endif
+#if DEVICES == 3
+    hid.getConsumerControl().tap(HIDGenericImpl::ConsumerControl::CONSUMER_VOLUME_UP);
+#endif
+#if DEVICES == 4
+    static uint8_t button;
+    hid.getGamepad().setButtons(0);
+    hid.getGamepad().press(button++ % HIDGenericImpl::Gamepad::BUTTONS);
+    hid.getGamepad().flush();
+#endif
+    delay(1000);
+}
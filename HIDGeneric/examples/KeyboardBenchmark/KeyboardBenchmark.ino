@@ -0,0 +1,132 @@
+// KeyboardBenchmark
+//
+// Measures the CPU time spent in the keyboard press/release path. The
+// reports go to a transport that throws them away, so what is left is
+// the translation, slot search and report assembly in HIDGeneric
+// itself.
+//
+// On AVR boards Timer1 is run from the undivided CPU clock and the
+// results are printed in cycles. Elsewhere micros() is used and the
+// results are in microseconds, which is only good for rough
+// comparisons. Build this against two revisions of the library to
+// compare them.
+
+#include <HIDGeneric.h>
+
+// Transport that discards everything sent to it
+class NullTransport {
+public:
+    void sendReport(const void* data, uint32_t len) {}
+    void sendControl(uint8_t flags, const void* data, uint32_t len) {}
+    int receiveReport(void* data, uint32_t len) { return 0; }
+};
+
+NullTransport null;
+typedef HIDGeneric<NullTransport, HIDKeyboard> HID;
+HID hid(null);
+
+static const char text[] = "The Quick Brown Fox Jumps Over The Lazy Dog 0123456789!";
+
+#if defined(__AVR__)
+#define UNITS "cycles"
+
+static void startTimer() {
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+}
+
+static inline uint16_t now() {
+    return TCNT1;
+}
+#else
+#define UNITS "us"
+
+static void startTimer() {}
+
+static inline uint16_t now() {
+    return (uint16_t)micros();
+}
+#endif
+
+// Each measured call is short enough that a 16 bit count cannot wrap.
+// Interrupts are off so that the timer tick does not land in the count.
+static uint32_t timePresses(uint8_t key, uint16_t n) {
+    uint32_t total = 0;
+    for (uint16_t i = 0; i < n; i++) {
+        noInterrupts();
+        uint16_t t0 = now();
+        hid.getKeyboard().press(key);
+        uint16_t t1 = now();
+        hid.getKeyboard().release(key);
+        interrupts();
+        total += (uint16_t)(t1 - t0);
+    }
+    return total / n;
+}
+
+static uint32_t timeReleases(uint8_t key, uint16_t n) {
+    uint32_t total = 0;
+    for (uint16_t i = 0; i < n; i++) {
+        noInterrupts();
+        hid.getKeyboard().press(key);
+        uint16_t t0 = now();
+        hid.getKeyboard().release(key);
+        uint16_t t1 = now();
+        interrupts();
+        total += (uint16_t)(t1 - t0);
+    }
+    return total / n;
+}
+
+static void report(const char* name, uint32_t value) {
+    Serial.print(name);
+    Serial.print(": ");
+    Serial.print(value);
+    Serial.println(" " UNITS);
+}
+
+void setup() {
+    Serial.begin(115200);
+    hid.begin();
+    startTimer();
+
+    // Overhead of the measurement itself
+    noInterrupts();
+    uint16_t t0 = now();
+    uint16_t t1 = now();
+    interrupts();
+    report("timer overhead", (uint16_t)(t1 - t0));
+
+    report("press 'a'", timePresses('a', 100));
+    report("press 'A'", timePresses('A', 100));
+    report("press left shift", timePresses(HID::Keyboard::KEYBOARD_LEFT_SHIFT, 100));
+    report("press F1", timePresses(HID::Keyboard::KEYBOARD_F1, 100));
+    report("release 'a'", timeReleases('a', 100));
+    report("release 'A'", timeReleases('A', 100));
+
+    // Slot search with five keys already down
+    hid.getKeyboard().press('1');
+    hid.getKeyboard().press('2');
+    hid.getKeyboard().press('3');
+    hid.getKeyboard().press('4');
+    hid.getKeyboard().press('5');
+    report("press 'a' (5 held)", timePresses('a', 100));
+    report("release 'a' (5 held)", timeReleases('a', 100));
+    hid.getKeyboard().releaseAll();
+
+    // write() of each character in a string, which includes the
+    // release after it
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < sizeof(text) - 1; i++) {
+        noInterrupts();
+        uint16_t s0 = now();
+        hid.getKeyboard().write(text[i]);
+        uint16_t s1 = now();
+        interrupts();
+        total += (uint16_t)(s1 - s0);
+    }
+    report("write() per character", total / (sizeof(text) - 1));
+}
+
+void loop() {
+}
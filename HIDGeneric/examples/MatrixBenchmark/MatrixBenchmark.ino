@@ -0,0 +1,99 @@
+// MatrixBenchmark
+//
+// Measures how many scans per second HIDMatrix manages over a simulated
+// 8 x 16 matrix, so the numbers are for the debounce and key handling
+// alone and not the pin reads. The reports go to a transport that
+// throws them away.
+//
+// Three cases are timed for one second each: no keys down, keys held
+// steady, and keys chattering on every scan so that every row is being
+// debounced. Build this against two revisions of the library to compare
+// them.
+
+#include <HIDGeneric.h>
+#include <HIDMatrix.h>
+
+// Transport that discards everything sent to it
+class NullTransport {
+public:
+    void sendReport(const void* data, uint32_t len) {}
+    void sendControl(uint8_t flags, const void* data, uint32_t len) {}
+    int receiveReport(void* data, uint32_t len) { return 0; }
+};
+
+NullTransport null;
+typedef HIDGeneric<NullTransport, HIDKeyboard> HID;
+HID hid(null);
+
+static const uint8_t ROWS = 8;
+static const uint8_t COLS = 16;
+
+// Letters and digits (as raw keys), repeated to fill the matrix
+#define K(usage) (HIDGenericImpl::Keyboard::KEYBOARD_USAGE + (usage))
+
+static const uint8_t keymap[ROWS * COLS] PROGMEM = {
+    K(0x04), K(0x05), K(0x06), K(0x07), K(0x08), K(0x09), K(0x0a), K(0x0b),
+    K(0x0c), K(0x0d), K(0x0e), K(0x0f), K(0x10), K(0x11), K(0x12), K(0x13),
+    K(0x14), K(0x15), K(0x16), K(0x17), K(0x18), K(0x19), K(0x1a), K(0x1b),
+    K(0x1c), K(0x1d), K(0x1e), K(0x1f), K(0x20), K(0x21), K(0x22), K(0x23),
+    K(0x24), K(0x25), K(0x26), K(0x27), K(0x04), K(0x05), K(0x06), K(0x07),
+    K(0x08), K(0x09), K(0x0a), K(0x0b), K(0x0c), K(0x0d), K(0x0e), K(0x0f),
+    K(0x10), K(0x11), K(0x12), K(0x13), K(0x14), K(0x15), K(0x16), K(0x17),
+    K(0x18), K(0x19), K(0x1a), K(0x1b), K(0x1c), K(0x1d), K(0x1e), K(0x1f),
+    K(0x20), K(0x21), K(0x22), K(0x23), K(0x24), K(0x25), K(0x26), K(0x27),
+    K(0x04), K(0x05), K(0x06), K(0x07), K(0x08), K(0x09), K(0x0a), K(0x0b),
+    K(0x0c), K(0x0d), K(0x0e), K(0x0f), K(0x10), K(0x11), K(0x12), K(0x13),
+    K(0x14), K(0x15), K(0x16), K(0x17), K(0x18), K(0x19), K(0x1a), K(0x1b),
+    K(0x1c), K(0x1d), K(0x1e), K(0x1f), K(0x20), K(0x21), K(0x22), K(0x23),
+    K(0x24), K(0x25), K(0x26), K(0x27), K(0x04), K(0x05), K(0x06), K(0x07),
+    K(0x08), K(0x09), K(0x0a), K(0x0b), K(0x0c), K(0x0d), K(0x0e), K(0x0f),
+    K(0x10), K(0x11), K(0x12), K(0x13), K(0x14), K(0x15), K(0x16), K(0x17),
+};
+
+HIDMatrixSim sim;
+HIDMatrix<HID> matrix(hid, &sim, ROWS, COLS, keymap);
+
+static void report(const char* name, uint32_t scans) {
+    Serial.print(name);
+    Serial.print(": ");
+    Serial.print(scans);
+    Serial.println(" scans/s");
+}
+
+// Scan for one second. With chatter set, a switch in every row flips
+// before each scan, which keeps all the counters running.
+static uint32_t scansPerSecond(bool chatter) {
+    uint32_t n = 0;
+    uint32_t start = millis();
+    while ((uint32_t)(millis() - start) < 1000) {
+        if (chatter) {
+            for (uint8_t row = 0; row < ROWS; row++) {
+                sim.setRow(row, sim.readRow(row) ^ 0x8000);
+            }
+        }
+        matrix.poll();
+        n++;
+    }
+    return n;
+}
+
+void setup() {
+    Serial.begin(115200);
+    hid.begin();
+
+    report("idle", scansPerSecond(false));
+
+    // Three keys held, let them settle first
+    sim.press(0, 0);
+    sim.press(3, 7);
+    sim.press(7, 15);
+    for (uint8_t i = 0; i < 8; i++) {
+        matrix.poll();
+    }
+    report("3 keys held", scansPerSecond(false));
+
+    report("chattering", scansPerSecond(true));
+}
+
+void loop() {
+}
@@ -0,0 +1,142 @@
+// ReportBenchmark
+//
+// Measures packing reports by usage through HIDReportMap against the
+// hand written packing of the built in devices. The map is parsed from
+// the library's own mouse and gamepad descriptors, so the same reports
+// are built both ways.
+//
+// On AVR boards Timer1 is run from the undivided CPU clock and the
+// results are printed in cycles. Elsewhere micros() is used and the
+// results are in microseconds, which is only good for rough
+// comparisons.
+
+#include <HIDGeneric.h>
+#include <HIDReport.h>
+
+#if defined(__AVR__)
+#define UNITS "cycles"
+
+static void startTimer() {
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+}
+
+static inline uint16_t now() {
+    return TCNT1;
+}
+#else
+#define UNITS "us"
+
+static void startTimer() {}
+
+static inline uint16_t now() {
+    return (uint16_t)micros();
+}
+#endif
+
+HIDReportMap mouseMap;
+HIDReportMap gamepadMap;
+
+static volatile uint8_t sink;
+
+static void report(const char* name, uint32_t value) {
+    Serial.print(name);
+    Serial.print(": ");
+    Serial.print(value);
+    Serial.println(" " UNITS);
+}
+
+static const uint16_t RUNS = 100;
+
+void setup() {
+    Serial.begin(115200);
+    startTimer();
+
+    uint16_t t0 = now();
+    mouseMap.parse(HIDGenericImpl::Mouse::descriptor,
+                   HIDGenericImpl::Mouse::DESCRIPTOR_SIZE);
+    gamepadMap.parse(HIDGenericImpl::Gamepad::descriptor,
+                     HIDGenericImpl::Gamepad::DESCRIPTOR_SIZE);
+    uint16_t t1 = now();
+    report("parse mouse and gamepad descriptors", (uint16_t)(t1 - t0));
+
+    HIDReport mouse(mouseMap, HIDGenericImpl::MOUSE_REPORT_ID);
+    HIDReport gamepad(gamepadMap, HIDGenericImpl::GAMEPAD_REPORT_ID);
+    uint32_t total;
+
+    // Mouse report: buttons, X, Y and wheel
+    total = 0;
+    for (uint16_t i = 0; i < RUNS; i++) {
+        noInterrupts();
+        t0 = now();
+        mouse.press(0x09, 1);
+        mouse.set(0x01, 0x30, (int8_t)i);
+        mouse.set(0x01, 0x31, -(int8_t)i);
+        mouse.set(0x01, 0x38, 1);
+        t1 = now();
+        interrupts();
+        total += (uint16_t)(t1 - t0);
+        sink = mouse.getData()[1];
+    }
+    report("mouse report by usage", total / RUNS);
+
+    total = 0;
+    for (uint16_t i = 0; i < RUNS; i++) {
+        uint8_t m[4];
+        noInterrupts();
+        t0 = now();
+        m[0] = 1;
+        m[1] = i;
+        m[2] = -i;
+        m[3] = 1;
+        t1 = now();
+        interrupts();
+        total += (uint16_t)(t1 - t0);
+        sink = m[1];
+    }
+    report("mouse report by hand", total / RUNS);
+
+    // Gamepad report: a button, a hat (4 bit, unaligned) and two axes
+    total = 0;
+    for (uint16_t i = 0; i < RUNS; i++) {
+        noInterrupts();
+        t0 = now();
+        gamepad.press(0x09, 1 + (i & 31));
+        gamepad.set(0x01, 0x39, i & 7);
+        gamepad.set(0x01, 0x30, (int8_t)i);
+        gamepad.set(0x01, 0x31, -(int8_t)i);
+        t1 = now();
+        interrupts();
+        total += (uint16_t)(t1 - t0);
+        sink = gamepad.getData()[4];
+    }
+    report("gamepad report by usage", total / RUNS);
+
+    // Raw packing with the field already looked up
+    uint8_t buf[8];
+    total = 0;
+    for (uint16_t i = 0; i < RUNS; i++) {
+        noInterrupts();
+        t0 = now();
+        HIDReportMap::pack(buf, 8, 8, i);
+        t1 = now();
+        interrupts();
+        total += (uint16_t)(t1 - t0);
+    }
+    report("pack 8 bits aligned", total / RUNS);
+
+    total = 0;
+    for (uint16_t i = 0; i < RUNS; i++) {
+        noInterrupts();
+        t0 = now();
+        HIDReportMap::pack(buf, 12, 12, i);
+        t1 = now();
+        interrupts();
+        total += (uint16_t)(t1 - t0);
+    }
+    report("pack 12 bits unaligned", total / RUNS);
+    sink = buf[2];
+}
+
+void loop() {
+}
@@ -0,0 +1,62 @@
+// Arduino.cpp
+//
+// Host stand-in for the Arduino core - see Arduino.h
+
+#include "Arduino.h"
+#include <time.h>
+
+unsigned long hostMicros   = 0;
+bool          hostRealTime = false;
+bool          hostVerbose  = false;
+uint8_t       hostPins[64];
+HostSerial    Serial;
+
+unsigned long micros(void)
+{
+    if (hostRealTime) {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec * 1000000UL + t.tv_nsec / 1000;
+    }
+    return hostMicros;
+}
+
+unsigned long millis(void)
+{
+    return micros() / 1000;
+}
+
+void delay(unsigned long ms)
+{
+    if (hostRealTime) {
+        struct timespec t = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000L };
+        nanosleep(&t, NULL);
+    }
+    else {
+        hostMicros += ms * 1000;
+    }
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    if (!hostRealTime) {
+        hostMicros += us;
+    }
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    if (mode == INPUT_PULLUP) {
+        hostPins[pin] = HIGH;
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    hostPins[pin] = value;
+}
+
+int digitalRead(uint8_t pin)
+{
+    return hostPins[pin];
+}
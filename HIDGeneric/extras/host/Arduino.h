@@ -0,0 +1,91 @@
+// Arduino.h
+//
+// Just enough of the Arduino core for building the libraries on a Linux
+// host, for the tests in this directory (see run.sh) and
+// RN42/extras/rn42emu/rn42test. Time only moves when a
+// program moves it (hostMicros), or runs in real time if hostRealTime
+// is set. Serial prints go to stdout when hostVerbose is set.
+
+#ifndef __HOST_ARDUINO_H__
+#define __HOST_ARDUINO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#define PROGMEM
+#define pgm_read_byte(p)  (*(const uint8_t*)(p))
+#define pgm_read_word(p)  (*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+
+#define LOW          0
+#define HIGH         1
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+
+extern unsigned long hostMicros;
+extern bool          hostRealTime;
+extern bool          hostVerbose;
+extern uint8_t       hostPins[64];
+
+unsigned long micros(void);
+unsigned long millis(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int  digitalRead(uint8_t pin);
+inline void noInterrupts(void) {}
+inline void interrupts(void) {}
+
+class String : public std::string {
+  public:
+    String() {}
+    String(const char* s) : std::string(s) {}
+    String& operator+=(char c) { push_back(c); return *this; }
+    bool operator==(const char* s) const { return compare(s) == 0; }
+    const char* c_str() const { return std::string::c_str(); }
+};
+
+// Serial - output is thrown away unless hostVerbose is set
+class HostSerial {
+  public:
+    void begin(unsigned long) {}
+    int available(void) { return 0; }
+    int read(void) { return -1; }
+    void flush(void) { fflush(stdout); }
+    size_t write(uint8_t c) {
+        if (hostVerbose) {
+            putchar(c);
+        }
+        return 1;
+    }
+    void print(const char* s) { while (*s) write(*s++); }
+    void print(const String& s) { print(s.c_str()); }
+    void print(char c) { write(c); }
+    void print(long n) { char b[24]; snprintf(b, sizeof(b), "%ld", n); print(b); }
+    void print(unsigned long n) { char b[24]; snprintf(b, sizeof(b), "%lu", n); print(b); }
+    void print(int n) { print((long)n); }
+    void print(unsigned int n) { print((unsigned long)n); }
+    void print(unsigned char n) { print((unsigned long)n); }
+    template <typename T> void println(T v) { print(v); write('\n'); }
+    void println(void) { write('\n'); }
+};
+
+extern HostSerial Serial;
+
+// USB setup packet, from the core's USBAPI.h
+typedef struct {
+    uint8_t  bmRequestType;
+    uint8_t  bRequest;
+    uint8_t  wValueL;
+    uint8_t  wValueH;
+    uint16_t wIndex;
+    uint16_t wLength;
+} Setup;
+
+#endif
@@ -0,0 +1,106 @@
+// caps_test
+//
+// Shift handling of the keyboard: the Caps Lock flip of letters when
+// typing, and press()/release() leaving a Shift the application holds
+// alone
+
+#include "HIDGeneric.h"
+#include "host_test.h"
+
+#include <vector>
+
+// Transport that keeps the keyboard reports sent
+struct Recorder {
+    std::vector<std::vector<uint8_t> > reports;
+
+    void sendReport(const void* data, uint32_t len) {
+        const uint8_t* p = (const uint8_t*)data;
+        reports.push_back(std::vector<uint8_t>(p, p + len));
+    }
+    void sendControl(uint8_t, const void*, uint32_t) {}
+    int receiveReport(void*, uint32_t) { return 0; }
+};
+
+typedef HIDGeneric<Recorder, HIDKeyboard> HID;
+typedef HIDGenericImpl::Keyboard Keys;
+
+static const uint8_t SHIFT = 0x02;
+
+static Recorder recorder;
+static HID hid(recorder);
+
+// Modifiers and first key of the last report
+static uint8_t modifiers(void) { return recorder.reports.back()[1]; }
+static uint8_t key(void) { return recorder.reports.back()[3]; }
+
+// Modifiers of the report that pressed the key of a write()
+static uint8_t
+writeModifiers(uint8_t c)
+{
+    size_t before = recorder.reports.size();
+    hid.getKeyboard().write(c);
+    CHECK(recorder.reports.size() == before + 2);
+    return recorder.reports[before][1];
+}
+
+int
+main()
+{
+    HID::Keyboard& keyboard = hid.getKeyboard();
+    hid.begin();
+
+    // A character that needs Shift brings its own and takes it away
+    keyboard.press('A');
+    CHECK(modifiers() == SHIFT && key() == 0x04);
+    keyboard.release('A');
+    CHECK(modifiers() == 0 && key() == 0);
+
+    // A Shift the application holds survives the release of a letter,
+    // whether or not the letter needed Shift itself
+    keyboard.press(Keys::KEYBOARD_LEFT_SHIFT);
+    keyboard.press('a');
+    keyboard.release('a');
+    CHECK(modifiers() == SHIFT && key() == 0);
+    keyboard.press('A');
+    keyboard.release('A');
+    CHECK(modifiers() == SHIFT);
+    keyboard.releaseAll();
+
+    // ... and also when it is pressed after the letter
+    keyboard.press('A');
+    keyboard.press(Keys::KEYBOARD_LEFT_SHIFT);
+    keyboard.release('A');
+    CHECK(modifiers() == SHIFT);
+    keyboard.releaseAll();
+    CHECK(modifiers() == 0);
+
+    // With Caps Lock on, press() is still the key itself
+    keyboard.setLeds(Keys::LED_CAPS_LOCK);
+    keyboard.press('a');
+    CHECK(modifiers() == 0 && key() == 0x04);
+    keyboard.release('a');
+    keyboard.press('A');
+    CHECK(modifiers() == SHIFT && key() == 0x04);
+    keyboard.release('A');
+    CHECK(modifiers() == 0);
+
+    // but typing flips the Shift of letters only
+    CHECK(writeModifiers('a') == SHIFT);
+    CHECK(writeModifiers('A') == 0);
+    CHECK(writeModifiers('1') == 0);
+    CHECK(writeModifiers('!') == SHIFT);
+    CHECK(modifiers() == 0);
+
+    // A held Shift outlasts a typed letter under Caps Lock too
+    keyboard.press(Keys::KEYBOARD_LEFT_SHIFT);
+    keyboard.write('b');
+    CHECK(modifiers() == SHIFT && key() == 0);
+    keyboard.releaseAll();
+
+    // Caps Lock off again - no flip
+    keyboard.setLeds(0);
+    CHECK(writeModifiers('a') == 0);
+    CHECK(writeModifiers('A') == SHIFT);
+
+    return testResult("caps_test");
+}
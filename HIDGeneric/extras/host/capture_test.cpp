@@ -0,0 +1,167 @@
+// capture_test
+//
+// HIDCaptureRing dropping old records as it wraps, and HIDReplay
+// sending a captured log back at the recorded spacing
+
+#include "HIDGeneric.h"
+#include "HIDCapture.h"
+#include "host_test.h"
+
+#include <stdlib.h>
+#include <deque>
+#include <vector>
+
+// Transport that keeps the reports sent and when
+struct Recorder : public HIDGenericImpl::Transport {
+    std::vector<std::vector<uint8_t> > reports;
+    std::vector<unsigned long> times;
+
+    virtual void sendReport(const void* data, uint32_t len) {
+        const uint8_t* p = (const uint8_t*)data;
+        reports.push_back(std::vector<uint8_t>(p, p + len));
+        times.push_back(micros());
+    }
+    virtual void sendControl(uint8_t, const void*, uint32_t) {}
+};
+
+// Capture that keeps every record, to check the ring against
+class Everything : public HIDCapture {
+  public:
+    std::deque<std::vector<uint8_t> > records;
+
+  protected:
+    virtual void write(const uint8_t* header, uint8_t headerLen,
+                       const uint8_t* data, uint8_t len) {
+        std::vector<uint8_t> r(header, header + headerLen);
+        r.insert(r.end(), data, data + len);
+        records.push_back(r);
+    }
+};
+
+static const uint16_t RING_SIZE = 40;
+
+int
+main()
+{
+    uint8_t buffer[RING_SIZE];
+    uint8_t out[RING_SIZE];
+    uint8_t payload[32];
+
+    for (uint8_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = i + 1;
+    }
+
+    // Three records of 11, 11 and 12 bytes (the last has a two byte
+    // time) don't fit in 32 - the oldest goes
+    {
+        HIDCaptureRing ring(buffer, 32);
+        ring.record(1000, 2, payload, 8);
+        ring.record(1100, 2, payload, 8);
+        ring.record(1300, 1, payload, 8);
+        CHECK(ring.getDroppedRecords() == 1);
+        CHECK(ring.available() == 23);
+
+        uint16_t n = ring.read(out, sizeof(out));
+        CHECK(n == 23);
+        uint32_t delta;
+        uint8_t  id, len;
+        CHECK(HIDCapture::decodeHeader(out, n, delta, id, len) == 3);
+        CHECK(delta == 100 && id == 2 && len == 8);
+        CHECK(HIDCapture::decodeHeader(out + 11, n - 11, delta, id, len) == 4);
+        CHECK(delta == 200 && id == 1 && len == 8);
+        CHECK(ring.available() == 0);
+
+        // A record larger than the whole ring is counted and dropped
+        ring.record(1400, 3, payload, 32);
+        CHECK(ring.getDroppedRecords() == 2 && ring.available() == 0);
+    }
+
+    // Random records and reads across many wraps: the ring always holds
+    // the newest records that fit, whole and in order
+    {
+        HIDCaptureRing ring(buffer, RING_SIZE);
+        Everything all;
+        std::deque<std::vector<uint8_t> > expect;
+        uint16_t expectUsed = 0;
+        uint32_t time = 0;
+        int bad = 0;
+
+        srand(1);
+        for (int i = 0; i < 20000; i++) {
+            uint8_t len = rand() % 12;
+            uint8_t id  = 1 + rand() % 4;
+            time += rand() % 3 ? rand() % 100 : rand() % 100000;
+            ring.record(time, id, payload, len);
+            all.record(time, id, payload, len);
+
+            expect.push_back(all.records.back());
+            expectUsed += expect.back().size();
+            while (expectUsed > RING_SIZE) {
+                expectUsed -= expect.front().size();
+                expect.pop_front();
+            }
+            if (ring.available() != expectUsed) {
+                bad++;
+            }
+
+            if (rand() % 8 == 0) {
+                // Read into a buffer that may be too small for all of
+                // it - only whole records come out
+                uint16_t room = rand() % RING_SIZE;
+                uint16_t n = ring.read(out, room);
+                uint16_t pos = 0;
+                while (!expect.empty() && pos + expect.front().size() <= room) {
+                    const std::vector<uint8_t>& r = expect.front();
+                    if (pos + r.size() > n || memcmp(out + pos, &r[0], r.size())) {
+                        bad++;
+                    }
+                    pos += r.size();
+                    expectUsed -= r.size();
+                    expect.pop_front();
+                }
+                if (pos != n) {
+                    bad++;
+                }
+            }
+        }
+        CHECK(bad == 0);
+    }
+
+    // Replay at the recorded spacing, twice as fast and back to back
+    // (one report on each poll, which come every 10us here)
+    {
+        HIDCaptureRing ring(buffer, RING_SIZE);
+        ring.record(5000, 2, payload, 2);
+        ring.record(5300, 1, payload, 3);
+        ring.record(6300, 2, payload, 1);
+        uint16_t n = ring.read(out, sizeof(out));
+
+        static const uint8_t speeds[3]      = { 1, 2, 0 };
+        static const unsigned long last[3]  = { 1300, 650, 20 };
+        for (uint8_t s = 0; s < 3; s++) {
+            Recorder sent;
+            HIDReplay replay(&sent, out, n);
+            replay.setSpeed(speeds[s]);
+
+            hostMicros = 70000;
+            int polls = 0;
+            while (replay.poll() && polls < 10000) {
+                hostMicros += 10;
+                polls++;
+            }
+            CHECK(replay.getReportCount() == 3);
+            CHECK(sent.reports.size() == 3);
+            if (sent.reports.size() != 3) {
+                continue;
+            }
+            CHECK(sent.reports[0].size() == 3 && sent.reports[0][0] == 2);
+            CHECK(sent.reports[1].size() == 4 && sent.reports[1][0] == 1);
+            CHECK(sent.reports[2].size() == 2 && sent.reports[2][0] == 2);
+            CHECK(sent.reports[1][3] == 3);
+            CHECK(sent.times[0] == 70000);
+            CHECK(sent.times[2] - sent.times[0] == last[s]);
+        }
+    }
+
+    return testResult("capture_test");
+}
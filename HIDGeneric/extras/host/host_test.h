@@ -0,0 +1,30 @@
+// host_test.h
+//
+// Checks for the host test programs in this directory. A failed
+// CHECK() is printed with its line and the program carries on, so one
+// run shows every failure. main() ends with testResult().
+
+#ifndef __HOST_TEST_H__
+#define __HOST_TEST_H__
+
+#include <stdio.h>
+
+static int testFailures_g = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            testFailures_g++; \
+        } \
+    } while (0)
+
+// Prints the outcome and gives the exit status for main()
+static inline int
+testResult(const char* name)
+{
+    printf("%s: %s\n", name, testFailures_g ? "FAILED" : "ok");
+    return testFailures_g ? 1 : 0;
+}
+
+#endif
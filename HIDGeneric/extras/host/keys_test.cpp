@@ -0,0 +1,104 @@
+// keys_test
+//
+// The six key slots of the keyboard report (a seventh key refused,
+// duplicates and reuse of a freed slot) and what press() sends for
+// each kind of keymap entry
+
+#include "HIDGeneric.h"
+#include "host_test.h"
+
+#include <vector>
+
+// Transport that keeps the keyboard reports sent
+struct Recorder {
+    std::vector<std::vector<uint8_t> > reports;
+
+    void sendReport(const void* data, uint32_t len) {
+        const uint8_t* p = (const uint8_t*)data;
+        reports.push_back(std::vector<uint8_t>(p, p + len));
+    }
+    void sendControl(uint8_t, const void*, uint32_t) {}
+    int receiveReport(void*, uint32_t) { return 0; }
+};
+
+typedef HIDGeneric<Recorder, HIDKeyboard> HID;
+typedef HIDGenericImpl::Keyboard Keys;
+
+#define K(usage) (Keys::KEYBOARD_USAGE + (usage))
+
+static Recorder recorder;
+static HID hid(recorder);
+
+// Modifiers and key slot of the last report
+static uint8_t modifiers(void) { return recorder.reports.back()[1]; }
+static uint8_t slot(uint8_t i) { return recorder.reports.back()[3 + i]; }
+
+// Modifiers and first key that press(k) sends, released again after
+static uint16_t
+pressed(uint8_t k)
+{
+    hid.getKeyboard().press(k);
+    uint16_t r = modifiers() << 8 | slot(0);
+    hid.getKeyboard().releaseAll();
+    return r;
+}
+
+int
+main()
+{
+    HID::Keyboard& keyboard = hid.getKeyboard();
+    hid.begin();
+
+    // Six keys fill the slots in order, the seventh is refused and
+    // sends nothing
+    for (uint8_t i = 0; i < 6; i++) {
+        CHECK(keyboard.press(K(0x04 + i)) == 1);
+    }
+    size_t before = recorder.reports.size();
+    CHECK(keyboard.press(K(0x0a)) == 0);
+    CHECK(recorder.reports.size() == before);
+    for (uint8_t i = 0; i < 6; i++) {
+        CHECK(slot(i) == 0x04 + i);
+    }
+
+    // A key already held takes no second slot, even with all in use
+    CHECK(keyboard.press(K(0x06)) == 1);
+    for (uint8_t i = 0; i < 6; i++) {
+        CHECK(slot(i) == 0x04 + i);
+    }
+
+    // Releasing a key frees its slot, and the next key takes that one
+    keyboard.release(K(0x06));
+    CHECK(slot(2) == 0);
+    keyboard.press(K(0x14));
+    CHECK(slot(2) == 0x14 && slot(1) == 0x05 && slot(3) == 0x07);
+    keyboard.release(K(0x04));
+    keyboard.release(K(0x14));
+    keyboard.press(K(0x15));
+    CHECK(slot(0) == 0x15 && slot(2) == 0);
+
+    // Releasing a key that isn't held leaves the rest
+    keyboard.release(K(0x20));
+    CHECK(slot(0) == 0x15 && slot(5) == 0x09);
+    keyboard.releaseAll();
+    for (uint8_t i = 0; i < 6; i++) {
+        CHECK(slot(i) == 0);
+    }
+
+    // Keymap entries: characters with and without Shift, raw keys,
+    // modifier keys and keys with no entry
+    CHECK(pressed('a') == 0x0004);
+    CHECK(pressed('A') == 0x0204);
+    CHECK(pressed('1') == 0x001e);
+    CHECK(pressed('!') == 0x021e);
+    CHECK(pressed('\n') == 0x0028);
+    CHECK(pressed(' ') == 0x002c);
+    CHECK(pressed(K(0x3a)) == 0x003a);
+    CHECK(pressed(Keys::KEYBOARD_LEFT_SHIFT) == 0x0200);
+    CHECK(pressed(Keys::KEYBOARD_RIGHT_ALT) == 0x4000);
+    before = recorder.reports.size();
+    CHECK(keyboard.press(0x01) == 0);
+    CHECK(recorder.reports.size() == before);
+
+    return testResult("keys_test");
+}
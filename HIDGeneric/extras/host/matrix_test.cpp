@@ -0,0 +1,108 @@
+// matrix_test
+//
+// Debouncing and key reports of HIDMatrix, over a simulated matrix
+
+#include "HIDGeneric.h"
+#include "HIDMatrix.h"
+#include "host_test.h"
+
+#include <vector>
+
+// Transport that keeps the keyboard reports sent
+struct Recorder {
+    std::vector<std::vector<uint8_t> > reports;
+
+    void sendReport(const void* data, uint32_t len) {
+        const uint8_t* p = (const uint8_t*)data;
+        reports.push_back(std::vector<uint8_t>(p, p + len));
+    }
+    void sendControl(uint8_t, const void*, uint32_t) {}
+    int receiveReport(void*, uint32_t) { return 0; }
+};
+
+typedef HIDGeneric<Recorder, HIDKeyboard> HID;
+
+#define K(usage) (HIDGenericImpl::Keyboard::KEYBOARD_USAGE + (usage))
+
+// 'a' is a character and must be ignored, the rest are raw keys
+static const uint8_t keymap[2 * 3] PROGMEM = {
+    K(0x04), K(0x05), HIDGenericImpl::Keyboard::KEYBOARD_LEFT_SHIFT,
+    K(0x06), 0,       'a',
+};
+
+// Number of scans until the key changes, up to limit
+static int
+scansToChange(HIDMatrix<HID>& matrix, uint8_t row, uint8_t col, int limit)
+{
+    bool was = matrix.isPressed(row, col);
+    for (int i = 1; i <= limit; i++) {
+        matrix.poll();
+        if (matrix.isPressed(row, col) != was) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+int
+main()
+{
+    Recorder recorder;
+    HID hid(recorder);
+    HIDMatrixSim sim;
+    HIDMatrix<HID> matrix(hid, &sim, 2, 3, keymap);
+
+    // A press is taken after four scans that read it
+    sim.press(0, 0);
+    CHECK(scansToChange(matrix, 0, 0, 8) == 4);
+    CHECK(recorder.reports.size() == 1);
+    CHECK(recorder.reports.back()[3] == 0x04);
+
+    // Three scans of bounce and one that agrees again start the
+    // count over - it takes four more to release
+    sim.release(0, 0);
+    matrix.poll();
+    matrix.poll();
+    matrix.poll();
+    sim.press(0, 0);
+    matrix.poll();
+    CHECK(matrix.isPressed(0, 0));
+    sim.release(0, 0);
+    CHECK(scansToChange(matrix, 0, 0, 8) == 4);
+    CHECK(recorder.reports.size() == 2);
+    CHECK(recorder.reports.back()[3] == 0);
+
+    // Chattering on every scan never gets through
+    for (int i = 0; i < 20; i++) {
+        if (i & 1) {
+            sim.release(1, 0);
+        }
+        else {
+            sim.press(1, 0);
+        }
+        matrix.poll();
+        CHECK(!matrix.isPressed(1, 0));
+    }
+    sim.release(1, 0);
+    for (int i = 0; i < 4; i++) {
+        matrix.poll();
+    }
+
+    // Keys that settle in the same scan go in one report, with the
+    // modifier as a modifier; the character in the keymap is ignored
+    size_t before = recorder.reports.size();
+    sim.press(0, 1);
+    sim.press(0, 2);
+    sim.press(1, 0);
+    sim.press(1, 2);
+    for (int i = 0; i < 4; i++) {
+        matrix.poll();
+    }
+    CHECK(matrix.isPressed(1, 2));
+    CHECK(recorder.reports.size() == before + 1);
+    const std::vector<uint8_t>& r = recorder.reports.back();
+    CHECK(r[1] == 0x02);
+    CHECK(r[3] == 0x05 && r[4] == 0x06 && r[5] == 0);
+
+    return testResult("matrix_test");
+}
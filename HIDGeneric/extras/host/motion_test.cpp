@@ -0,0 +1,85 @@
+// motion_test
+//
+// HIDMotion paths: where they end, how many reports they take, and
+// motions of no duration
+
+#include "HIDMotion.h"
+#include "host_test.h"
+
+// Mouse that adds up the moves it is given
+struct Mouse {
+    long x;
+    long y;
+    int  reports;
+
+    void move(signed char dx, signed char dy) {
+        x += dx;
+        y += dy;
+        reports++;
+    }
+};
+
+// Polls every step microseconds until the motion is over, or limit
+// polls have gone by. Returns the number of polls.
+static int
+run(HIDMotion<Mouse>& motion, unsigned long step, int limit)
+{
+    int polls = 0;
+    while (motion.isBusy() && polls < limit) {
+        hostMicros += step;
+        motion.poll();
+        polls++;
+    }
+    return polls;
+}
+
+int
+main()
+{
+    Mouse mouse = { 0, 0, 0 };
+    HIDMotion<Mouse> motion(mouse, 125);
+    hostMicros = 1000;
+
+    // A line ends exactly where it should, one report per 8ms at most
+    motion.line(1000, -333, 500);
+    CHECK(run(motion, 137, 100000) < 100000);
+    CHECK(mouse.x == 1000 && mouse.y == -333);
+    CHECK(mouse.reports <= 500 / 8 + 2);
+
+    // So does a curve
+    mouse.x = mouse.y = mouse.reports = 0;
+    motion.bezier(100, 300, 400, -300, 517, 3, 1000);
+    CHECK(run(motion, 1000, 100000) < 100000);
+    CHECK(mouse.x == 517 && mouse.y == 3);
+
+    // A line or curve of no duration goes straight there, in as many
+    // reports as the move needs, and then isn't busy any more
+    mouse.x = mouse.y = mouse.reports = 0;
+    motion.line(300, -20, 0);
+    CHECK(run(motion, 1000, 1000) < 1000);
+    CHECK(mouse.x == 300 && mouse.y == -20);
+    CHECK(mouse.reports == 3);
+
+    mouse.x = mouse.y = mouse.reports = 0;
+    motion.bezier(50, 50, 100, -50, 120, 10, 0);
+    CHECK(run(motion, 1000, 1000) < 1000);
+    CHECK(mouse.x == 120 && mouse.y == 10);
+    CHECK(mouse.reports == 1);
+
+    // A velocity for a time covers the distance and stops
+    mouse.x = mouse.y = mouse.reports = 0;
+    motion.velocity(-33, 7, 3000);
+    CHECK(run(motion, 333, 100000) < 100000);
+    CHECK(mouse.x == -99 && mouse.y == 21);
+
+    // but with no duration it goes on until stopped
+    mouse.x = mouse.y = mouse.reports = 0;
+    motion.velocity(100, 0);
+    CHECK(run(motion, 1000, 2000) == 2000);
+    CHECK(motion.isBusy());
+    CHECK(mouse.x >= 199 && mouse.x <= 200);
+    motion.stop();
+    CHECK(!motion.isBusy());
+
+    return testResult("motion_test");
+}
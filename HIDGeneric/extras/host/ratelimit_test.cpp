@@ -0,0 +1,162 @@
+// ratelimit_test
+//
+// Report rate limits: token buckets holding reports to their rate,
+// key presses and button changes going ahead of motion, and held
+// motion added up and sent once there is room
+//
+// build: -DHIDGENERIC_RATE_LIMIT
+
+#include "HIDGeneric.h"
+#include "host_test.h"
+
+#include <vector>
+
+// Transport that keeps every report sent and when
+struct Recorder {
+    std::vector<std::vector<uint8_t> > reports;
+    std::vector<unsigned long> times;
+
+    void sendReport(const void* data, uint32_t len) {
+        const uint8_t* p = (const uint8_t*)data;
+        reports.push_back(std::vector<uint8_t>(p, p + len));
+        times.push_back(hostMicros);
+    }
+    void sendControl(uint8_t, const void*, uint32_t) {}
+    int receiveReport(void*, uint32_t) { return 0; }
+
+    void clear(void) {
+        reports.clear();
+        times.clear();
+    }
+    size_t count(uint8_t id) {
+        size_t n = 0;
+        for (size_t i = 0; i < reports.size(); i++) {
+            n += reports[i][0] == id;
+        }
+        return n;
+    }
+    // Sum of the mouse X moves sent
+    long mouseX(void) {
+        long x = 0;
+        for (size_t i = 0; i < reports.size(); i++) {
+            if (reports[i][0] == HIDGenericImpl::MOUSE_REPORT_ID) {
+                x += (int8_t)reports[i][2];
+            }
+        }
+        return x;
+    }
+};
+
+typedef HIDGeneric<Recorder, HIDMouse, HIDKeyboard, HIDGamepad> HID;
+
+static const uint8_t MOUSE   = HIDGenericImpl::MOUSE_REPORT_ID;
+static const uint8_t KEYS    = HIDGenericImpl::KEYBOARD_REPORT_ID;
+static const uint8_t GAMEPAD = HIDGenericImpl::GAMEPAD_REPORT_ID;
+
+static Recorder recorder;
+static HID hid(recorder);
+
+// Polls once a millisecond for ms milliseconds
+static void
+wait(int ms)
+{
+    for (int i = 0; i < ms; i++) {
+        hostMicros += 1000;
+        hid.poll();
+    }
+}
+
+int
+main()
+{
+    HID::Mouse& mouse = hid.getMouse();
+    hostMicros = 1000000;
+    hid.begin();
+
+    // 100 mouse reports a second: moves every millisecond for a second
+    // go in one report per 10ms, and all of the motion gets there
+    hid.setReportRate(MOUSE, 100);
+    long moved = 0;
+    for (int ms = 0; ms < 1000; ms++) {
+        mouse.move(2, 0);
+        moved += 2;
+        wait(1);
+    }
+    wait(50);
+    CHECK(recorder.count(MOUSE) >= 100 && recorder.count(MOUSE) <= 102);
+    CHECK(recorder.mouseX() == moved);
+    for (size_t i = 1; i < recorder.times.size(); i++) {
+        CHECK(recorder.times[i] - recorder.times[i - 1] >= 10000);
+    }
+    CHECK(hid.getClassStats(HIDGenericImpl::PRIORITY_LOW).held > 0);
+
+    // With no limit every move is its own report again
+    hid.setReportRate(MOUSE, 0);
+    recorder.clear();
+    for (int i = 0; i < 10; i++) {
+        mouse.move(1, 0);
+    }
+    CHECK(recorder.count(MOUSE) == 10);
+
+    // A link of 50 reports a second with a burst of 4, used up by
+    // motion: held moves are added up and go in one report when the
+    // link has room again
+    hid.setLinkRate(50, 4);
+    recorder.clear();
+    for (int i = 0; i < 10; i++) {
+        mouse.move(3, 0);
+    }
+    CHECK(recorder.count(MOUSE) == 3);
+    CHECK(recorder.mouseX() == 9);
+    recorder.clear();
+    wait(5);
+    CHECK(recorder.reports.empty());
+    wait(60);
+    CHECK(recorder.count(MOUSE) == 1);
+    CHECK(recorder.reports.size() == 1 && (int8_t)recorder.reports[0][2] == 21);
+
+    // A key press isn't held however busy the link is
+    for (int i = 0; i < 10; i++) {
+        mouse.move(1, 0);
+    }
+    recorder.clear();
+    hid.getKeyboard().press('a');
+    hid.getKeyboard().release('a');
+    CHECK(recorder.count(KEYS) == 2);
+
+    // nor is a button change, which would be lost if it were merged
+    recorder.clear();
+    mouse.click();
+    CHECK(recorder.reports.size() == 2);
+    if (recorder.reports.size() == 2) {
+        CHECK(recorder.reports[0][1] == 1 && recorder.reports[1][1] == 0);
+    }
+
+    // Those used up the link, so a gamepad report (normal priority) is
+    // held too
+    hid.getGamepad().press(1);
+    CHECK(!hid.getGamepad().flush());
+    wait(200);
+    CHECK(recorder.count(GAMEPAD) == 1);
+
+    // Held motion (low priority) waits for a held gamepad report, even
+    // with room on the link - here the gamepad's own limit holds it
+    hid.setLinkRate(0);
+    hid.setReportRate(GAMEPAD, 10);
+    hid.getGamepad().press(2);
+    CHECK(hid.getGamepad().flush());
+    hid.getGamepad().press(3);
+    CHECK(!hid.getGamepad().flush());
+    recorder.clear();
+    mouse.move(1, 0);
+    mouse.move(1, 0);
+    CHECK(recorder.reports.empty());
+    wait(150);
+    CHECK(recorder.reports.size() == 2);
+    if (recorder.reports.size() == 2) {
+        CHECK(recorder.reports[0][0] == GAMEPAD);
+        CHECK(recorder.reports[1][0] == MOUSE && recorder.reports[1][2] == 2);
+    }
+
+    return testResult("ratelimit_test");
+}
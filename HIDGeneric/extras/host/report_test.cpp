@@ -0,0 +1,169 @@
+// report_test
+//
+// HIDReportMap parsing of the built-in descriptors, checked by packing
+// reports by usage and comparing them with what the devices send
+//
+// build:
+// build: -DHIDGENERIC_GAMEPAD_AXIS_BITS=16
+
+#include "HIDGeneric.h"
+#include "HIDReport.h"
+#include "host_test.h"
+
+#include <stdlib.h>
+
+// Transport that keeps the last report sent, without its ID
+struct LastReport {
+    uint8_t  data[32];
+    uint32_t len;
+
+    void sendReport(const void* report, uint32_t n) {
+        len = n - 1;
+        memcpy(data, (const uint8_t*)report + 1, len);
+    }
+    void sendControl(uint8_t, const void*, uint32_t) {}
+    int receiveReport(void*, uint32_t) { return 0; }
+};
+
+typedef HIDGeneric<LastReport, HIDMouse, HIDKeyboard, HIDConsumerControl, HIDGamepad> HID;
+
+static bool
+sameReport(HIDReport& packed, const LastReport& sent)
+{
+    return packed.getLength() == sent.len &&
+           memcmp(packed.getData(), sent.data, sent.len) == 0;
+}
+
+// 20 byte report, too long for a HIDReport buffer
+static const uint8_t longDescriptor[] PROGMEM = {
+    0x05, 0x01, 0x09, 0x05, 0xa1, 0x01, 0x85, 0x05,
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x14, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x08, 0x95, 0x14, 0x81, 0x02,
+    0xc0
+};
+
+// Report Size of 257 bits, which is 1 in its low byte
+static const uint8_t wideDescriptor[] PROGMEM = {
+    0x05, 0x01, 0x09, 0x05, 0xa1, 0x01, 0x85, 0x06,
+    0x09, 0x30, 0x76, 0x01, 0x01, 0x95, 0x01, 0x81, 0x02,
+    0xc0
+};
+
+int
+main()
+{
+    LastReport sent;
+    HID hid(sent);
+    hid.begin();
+
+    // Mouse: buttons, X, Y and wheel
+    HIDReportMap mouse;
+    CHECK(mouse.parse(HIDGenericImpl::Mouse::descriptor,
+                      HIDGenericImpl::Mouse::DESCRIPTOR_SIZE));
+    HIDReport m(mouse, HIDGenericImpl::MOUSE_REPORT_ID);
+    CHECK(m.getLength() == 4);
+    CHECK(m.press(0x09, 1) && m.press(0x09, 3));
+    CHECK(m.set(0x01, 0x30, -5) && m.set(0x01, 0x31, 7) && m.set(0x01, 0x38, 1));
+    hid.getMouse().press(HIDGenericImpl::Mouse::BUTTON_LEFT | HIDGenericImpl::Mouse::BUTTON_MIDDLE);
+    hid.getMouse().move(-5, 7, 1);
+    CHECK(sameReport(m, sent));
+
+    // Logical range is enforced, and values come back signed
+    int32_t x;
+    CHECK(m.set(0x01, 0x30, 300));
+    CHECK(m.get(0x01, 0x30, &x) && x == 127);
+    CHECK(m.set(0x01, 0x30, -300));
+    CHECK(m.get(0x01, 0x30, &x) && x == -127);
+
+    // Keyboard: modifiers and the key array
+    HIDReportMap keyboard;
+    CHECK(keyboard.parse(HIDGenericImpl::Keyboard::descriptor,
+                         HIDGenericImpl::Keyboard::DESCRIPTOR_SIZE));
+    HIDReport k(keyboard, HIDGenericImpl::KEYBOARD_REPORT_ID);
+    CHECK(k.getLength() == 8);
+    CHECK(keyboard.getReportLength(HIDGenericImpl::KEYBOARD_REPORT_ID,
+                                   HIDReportMap::REPORT_OUTPUT) == 1);
+    CHECK(k.press(0x07, 0xe1) && k.press(0x07, 0x05) && k.press(0x07, 0x06));
+    hid.getKeyboard().press(HIDGenericImpl::Keyboard::KEYBOARD_LEFT_SHIFT);
+    hid.getKeyboard().press(HIDGenericImpl::Keyboard::KEYBOARD_USAGE + 0x05);
+    hid.getKeyboard().press(HIDGenericImpl::Keyboard::KEYBOARD_USAGE + 0x06);
+    CHECK(sameReport(k, sent));
+    hid.getKeyboard().releaseAll();
+
+    // Consumer control: an array of 16 bit usages
+    HIDReportMap consumer;
+    CHECK(consumer.parse(HIDGenericImpl::ConsumerControl::descriptor,
+                         HIDGenericImpl::ConsumerControl::DESCRIPTOR_SIZE));
+    HIDReport c(consumer, HIDGenericImpl::CONSUMER_REPORT_ID);
+    CHECK(c.press(0x0c, 0xe9) && c.press(0x0c, 0xcd));
+    hid.getConsumerControl().press(HIDGenericImpl::ConsumerControl::CONSUMER_VOLUME_UP);
+    hid.getConsumerControl().press(HIDGenericImpl::ConsumerControl::CONSUMER_PLAY_PAUSE);
+    CHECK(sameReport(c, sent));
+
+    // Gamepad: buttons, hats (with a null state) and axes
+    HIDReportMap gamepad;
+    CHECK(gamepad.parse(HIDGenericImpl::Gamepad::descriptor,
+                        HIDGenericImpl::Gamepad::DESCRIPTOR_SIZE));
+    HIDReport g(gamepad, HIDGenericImpl::GAMEPAD_REPORT_ID);
+    CHECK(g.press(0x09, 1) && g.press(0x09, 12));
+    CHECK(g.set(0x01, 0x39, 3));
+    int8_t hat = gamepad.find(HIDGenericImpl::GAMEPAD_REPORT_ID,
+                              HIDReportMap::REPORT_INPUT, 0x01, 0x39);
+    CHECK(hat >= 0 && (gamepad.getField(hat).flags & HIDReportMap::FIELD_NULL));
+    gamepad.set(g.getData(), hat + 1, 0, 8);
+    CHECK(g.set(0x01, 0x30, -100) && g.set(0x01, 0x35, 50));
+    hid.getGamepad().press(0);
+    hid.getGamepad().press(11);
+    hid.getGamepad().setHat(0, 3);
+    hid.getGamepad().setAxis(0, -100);
+    hid.getGamepad().setAxis(5, 50);
+    hid.getGamepad().flush();
+    CHECK(sameReport(g, sent));
+
+    // A report longer than HIDREPORT_MAX_SIZE has no usable fields
+    HIDReportMap longMap;
+    CHECK(longMap.parse(longDescriptor, sizeof(longDescriptor)));
+    CHECK(longMap.getReportLength(5) == 20);
+    HIDReport l(longMap, 5);
+    CHECK(l.getLength() == 0);
+    CHECK(!l.press(0x09, 20) && !l.set(0x09, 1, 1));
+
+    // Report Size is checked before it is narrowed
+    HIDReportMap wideMap;
+    CHECK(!wideMap.parse(wideDescriptor, sizeof(wideDescriptor)));
+    CHECK(wideMap.getFieldCount() == 0);
+
+    // pack() and unpack() agree and leave the other bits alone
+    int bad = 0;
+    srand(1);
+    for (int i = 0; i < 100000; i++) {
+        uint8_t buf[8], orig[8];
+        for (int b = 0; b < 8; b++) {
+            buf[b] = orig[b] = rand();
+        }
+        uint8_t  size = 1 + rand() % 32;
+        uint16_t offset = rand() % (64 - size + 1);
+        uint32_t value = ((uint32_t)rand() << 16) ^ rand();
+        if (size < 32) {
+            value &= (1UL << size) - 1;
+        }
+        HIDReportMap::pack(buf, offset, size, value);
+        if (HIDReportMap::unpack(buf, offset, size) != value) {
+            bad++;
+        }
+        for (int bit = 0; bit < 64; bit++) {
+            if ((bit < offset || bit >= offset + size) &&
+                ((buf[bit / 8] ^ orig[bit / 8]) >> (bit % 8) & 1)) {
+                bad++;
+                break;
+            }
+        }
+    }
+    CHECK(bad == 0);
+
+#if HIDGENERIC_GAMEPAD_AXIS_BITS == 16
+    return testResult("report_test (16 bit axes)");
+#else
+    return testResult("report_test");
+#endif
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+#
+# run.sh
+#
+# Builds each *_test.cpp in this directory against the host stand-in
+# for the Arduino core and runs it. Needs g++. Exits non-zero if any
+# test fails.
+#
+# A test that needs other build settings lists them in lines of its
+# own starting "// build:", and is built and run once for each. An
+# empty one is the default settings.
+#
+# Usage:
+#   run.sh [name_test.cpp]...
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+LIB=$(cd "$HERE/../.." && pwd)
+BUILD=$(mktemp -d)
+trap 'rm -rf "$BUILD"' EXIT
+
+cd "$HERE"
+[ $# -gt 0 ] || set -- *_test.cpp
+
+status=0
+for test in "$@"; do
+    name=${test%.cpp}
+    if grep -q '^// build:' "$test"; then
+        sed -n 's|^// build: *||p' "$test" >"$BUILD/flags"
+    else
+        echo >"$BUILD/flags"
+    fi
+    while read -r flags; do
+        if ! g++ -std=gnu++98 -Wall $flags -I"$HERE" -I"$LIB" -o "$BUILD/$name" \
+                "$test" "$LIB"/*.cpp "$HERE/Arduino.cpp"; then
+            echo "$name $flags: build failed"
+            status=1
+            continue
+        fi
+        "$BUILD/$name" || status=1
+    done <"$BUILD/flags"
+done
+exit $status
@@ -0,0 +1,174 @@
+// transaction_test
+//
+// Bulk typing with write(buffer), which saves reports without changing
+// what the host sees typed, and transactions, which merge the changes
+// made inside them into one report per device
+
+#include "HIDGeneric.h"
+#include "host_test.h"
+
+#include <string>
+#include <vector>
+
+// Transport that keeps every report sent
+struct Recorder {
+    std::vector<std::vector<uint8_t> > reports;
+
+    void sendReport(const void* data, uint32_t len) {
+        const uint8_t* p = (const uint8_t*)data;
+        reports.push_back(std::vector<uint8_t>(p, p + len));
+    }
+    void sendControl(uint8_t, const void*, uint32_t) {}
+    int receiveReport(void*, uint32_t) { return 0; }
+
+    // Reports sent with the given ID
+    size_t count(uint8_t id) {
+        size_t n = 0;
+        for (size_t i = 0; i < reports.size(); i++) {
+            n += reports[i][0] == id;
+        }
+        return n;
+    }
+};
+
+typedef HIDGeneric<Recorder, HIDMouse, HIDKeyboard, HIDConsumerControl, HIDGamepad> HID;
+typedef HIDGenericImpl::Keyboard Keys;
+
+static Recorder recorder;
+static HID hid(recorder);
+
+// Letters as the host would see them typed from the keyboard reports:
+// a key counts when it goes down, in upper case if Shift is down with
+// it, and the keyboard has to end up with nothing held
+static std::string
+typed(void)
+{
+    std::string s;
+    uint8_t held[6] = { 0 };
+
+    for (size_t i = 0; i < recorder.reports.size(); i++) {
+        const std::vector<uint8_t>& r = recorder.reports[i];
+        if (r[0] != HIDGenericImpl::KEYBOARD_REPORT_ID) {
+            continue;
+        }
+        for (uint8_t j = 0; j < 6; j++) {
+            uint8_t k = r[3 + j];
+            if (k >= 0x04 && k <= 0x1d && !memchr(held, k, sizeof(held))) {
+                s += (r[1] & 0x22 ? 'A' : 'a') + k - 0x04;
+            }
+        }
+        memcpy(held, &r[3], sizeof(held));
+    }
+    for (uint8_t j = 0; j < 6; j++) {
+        if (held[j]) {
+            s += '!';
+        }
+    }
+    return s;
+}
+
+static std::string
+write(const char* text)
+{
+    recorder.reports.clear();
+    hid.getKeyboard().write((const uint8_t*)text, strlen(text));
+    return typed();
+}
+
+int
+main()
+{
+    HID::Keyboard& keyboard = hid.getKeyboard();
+    HID::Mouse& mouse = hid.getMouse();
+    hid.begin();
+
+    // Bulk typing goes from key to key without a release in between,
+    // so "abc" takes four reports instead of six
+    CHECK(write("abc") == "abc");
+    CHECK(recorder.reports.size() == 4);
+
+    // The same key twice, or a change of Shift, needs the release in
+    // between - "Hello" is eight reports
+    CHECK(write("aa") == "aa");
+    CHECK(recorder.reports.size() == 4);
+    CHECK(write("aAb") == "aAb");
+    CHECK(write("Hello") == "Hello");
+    CHECK(recorder.reports.size() == 8);
+
+    // A modifier the application holds stays down throughout
+    keyboard.press(Keys::KEYBOARD_LEFT_CTRL);
+    write("xy");
+    for (size_t i = 0; i < recorder.reports.size(); i++) {
+        CHECK(recorder.reports[i][1] & 0x01);
+    }
+    keyboard.releaseAll();
+
+    // A chord made in a transaction goes in one report at commit
+    recorder.reports.clear();
+    hid.beginTransaction();
+    keyboard.press(Keys::KEYBOARD_LEFT_CTRL);
+    keyboard.press(Keys::KEYBOARD_LEFT_SHIFT);
+    keyboard.press(Keys::KEYBOARD_ESC);
+    CHECK(recorder.reports.empty());
+    hid.commit();
+    CHECK(recorder.reports.size() == 1);
+    CHECK(recorder.reports[0][1] == 0x03 && recorder.reports[0][3] == 0x29);
+
+    // Nested transactions only send at the outermost commit, and a
+    // device that changed nothing sends nothing
+    recorder.reports.clear();
+    hid.beginTransaction();
+    keyboard.releaseAll();
+    hid.beginTransaction();
+    hid.getConsumerControl().press(HIDGenericImpl::ConsumerControl::CONSUMER_MUTE);
+    hid.commit();
+    CHECK(recorder.reports.empty());
+    hid.commit();
+    CHECK(recorder.reports.size() == 2);
+    CHECK(recorder.count(HIDGenericImpl::KEYBOARD_REPORT_ID) == 1);
+    CHECK(recorder.count(HIDGenericImpl::CONSUMER_REPORT_ID) == 1);
+    CHECK(recorder.count(HIDGenericImpl::MOUSE_REPORT_ID) == 0);
+
+    // Once committed nothing is held back any more
+    recorder.reports.clear();
+    keyboard.press(Keys::KEYBOARD_LEFT_ALT);
+    CHECK(recorder.reports.size() == 1);
+    keyboard.releaseAll();
+    hid.getConsumerControl().releaseAll();
+
+    // A button and moves merge too, with moves added up and spread
+    // over as many reports as they need
+    recorder.reports.clear();
+    hid.beginTransaction();
+    mouse.press(HIDGenericImpl::Mouse::BUTTON_LEFT);
+    mouse.move(100, -3);
+    mouse.move(100, -4);
+    hid.commit();
+    CHECK(recorder.reports.size() == 2);
+    if (recorder.reports.size() == 2) {
+        CHECK(recorder.reports[0][1] == 1 && recorder.reports[1][1] == 1);
+        CHECK((int8_t)recorder.reports[0][2] == 127 &&
+              (int8_t)recorder.reports[1][2] == 73);
+        CHECK((int8_t)recorder.reports[0][3] + (int8_t)recorder.reports[1][3] == -7);
+    }
+    mouse.release(HIDGenericImpl::Mouse::BUTTON_LEFT);
+
+    // A gamepad flush() waits for the commit
+    recorder.reports.clear();
+    hid.beginTransaction();
+    hid.getGamepad().press(3);
+    CHECK(!hid.getGamepad().flush());
+    hid.getGamepad().setAxis(HIDGenericImpl::Gamepad::AXIS_X, 10);
+    hid.commit();
+    CHECK(recorder.reports.size() == 1);
+    CHECK(recorder.count(HIDGenericImpl::GAMEPAD_REPORT_ID) == 1);
+
+    // A keystroke inside a transaction cancels out
+    recorder.reports.clear();
+    hid.beginTransaction();
+    keyboard.write('q');
+    hid.commit();
+    CHECK(typed() == "");
+
+    return testResult("transaction_test");
+}
@@ -0,0 +1,135 @@
+// utf8_test
+//
+// Keystrokes that writeUtf8() sends for valid, overlong, surrogate and
+// truncated UTF-8, and for a character typed with a dead key on each
+// layout
+//
+// build:
+// build: -DHIDGENERIC_LAYOUT=HIDGENERIC_LAYOUT_DE
+// build: -DHIDGENERIC_LAYOUT=HIDGENERIC_LAYOUT_FR
+
+#include "HIDGeneric.h"
+#include "host_test.h"
+
+#include <string>
+#include <vector>
+
+// Transport that notes each key as it goes down, with the modifiers
+// of that report
+struct Strokes {
+    std::vector<uint16_t> keys;
+    uint8_t held[6];
+
+    Strokes() { memset(held, 0, sizeof(held)); }
+
+    void sendReport(const void* data, uint32_t) {
+        const uint8_t* p = (const uint8_t*)data;
+        for (uint8_t i = 0; i < 6; i++) {
+            uint8_t k = p[3 + i];
+            if (k && !memchr(held, k, sizeof(held))) {
+                keys.push_back(p[1] << 8 | k);
+            }
+        }
+        memcpy(held, p + 3, sizeof(held));
+    }
+    void sendControl(uint8_t, const void*, uint32_t) {}
+    int receiveReport(void*, uint32_t) { return 0; }
+};
+
+typedef HIDGeneric<Strokes, HIDKeyboard> HID;
+
+static Strokes strokes;
+static HID hid(strokes);
+
+// The keys pressed for a US hex digit or x, as Unicode Hex Input
+// takes them on every layout, turned back into characters; '?' for
+// anything else
+static std::string
+typed(void)
+{
+    std::string s;
+    for (size_t i = 0; i < strokes.keys.size(); i++) {
+        uint8_t k = strokes.keys[i] & 0xff;
+        s += k >= 0x1e && k <= 0x26 ? '1' + k - 0x1e :
+             k == 0x27              ? '0' :
+             k >= 0x04 && k <= 0x09 ? 'a' + k - 0x04 :
+             k == 0x1b              ? 'x' : '?';
+    }
+    return s;
+}
+
+// Characters typed for the bytes of in
+static std::string
+utf8(const char* in)
+{
+    strokes.keys.clear();
+    hid.getKeyboard().writeUtf8(in);
+    return typed();
+}
+
+int
+main()
+{
+    HID::Keyboard& keyboard = hid.getKeyboard();
+    hid.begin();
+
+    // Option and the hex digits, laid out as US whatever the layout -
+    // none of these characters are on the layouts' keys
+    keyboard.setUnicodeMethod(HIDGenericImpl::Keyboard::UNICODE_MACOS);
+
+    // Valid sequences of each length, at the ends of their ranges
+    CHECK(utf8("\xdf\xbf") == "07ff");
+    CHECK(utf8("\xe0\xa0\x80") == "0800");
+    CHECK(utf8("\xed\x9f\xbf") == "d7ff");
+    CHECK(utf8("\xee\x80\x80") == "e000");
+    CHECK(utf8("\xf0\x9f\x98\x80") == "d83dde00");
+    CHECK(utf8("\xf4\x8f\xbf\xbf") == "dbffdfff");
+    CHECK(strokes.keys[0] >> 8 == 0x04);
+
+    // Overlong forms, surrogates and anything past U+10FFFF are
+    // skipped, and the byte after them is typed
+    CHECK(utf8("\xc0\xafx") == "x");
+    CHECK(utf8("\xc1\xbfx") == "x");
+    CHECK(utf8("\xe0\x9f\xbfx") == "x");
+    CHECK(utf8("\xf0\x8f\xbf\xbfx") == "x");
+    CHECK(utf8("\xed\xa0\x80x") == "x");
+    CHECK(utf8("\xed\xbf\xbfx") == "x");
+    CHECK(utf8("\xf4\x90\x80\x80x") == "x");
+    CHECK(utf8("\xf5\x80\x80\x80x") == "x");
+
+    // A sequence cut short by a lead byte or ASCII is dropped, and
+    // what cut it is taken as the start of the next
+    CHECK(utf8("\xe0\xa0x") == "x");
+    CHECK(utf8("\xf0\x9f\x98\xe0\xa0\x80") == "0800");
+    CHECK(utf8("\x80\xbfx") == "x");
+
+    // but one split across calls is put back together
+    CHECK(utf8("\xe0\xa0") == "");
+    CHECK(utf8("\x80") == "0800");
+
+    // A character with a dead key on the layout is the dead key and
+    // then the letter
+    strokes.keys.clear();
+#if HIDGENERIC_LAYOUT == HIDGENERIC_LAYOUT_DE
+    keyboard.writeUtf8("\xc3\xa9");                 // e acute
+    CHECK(strokes.keys.size() == 2);
+    CHECK(strokes.keys[0] == 0x002e);               // acute
+    CHECK(strokes.keys[1] == 0x0008);               // e
+#elif HIDGENERIC_LAYOUT == HIDGENERIC_LAYOUT_FR
+    keyboard.writeUtf8("\xc3\xab");                 // e diaeresis
+    CHECK(strokes.keys.size() == 2);
+    CHECK(strokes.keys[0] == 0x022f);               // shift ^
+    CHECK(strokes.keys[1] == 0x0008);               // e
+#else
+    keyboard.writeUtf8("\xc3\xa9");                 // no dead keys on US
+    CHECK(typed() == "00e9");
+#endif
+
+#if HIDGENERIC_LAYOUT == HIDGENERIC_LAYOUT_DE
+    return testResult("utf8_test (DE)");
+#elif HIDGENERIC_LAYOUT == HIDGENERIC_LAYOUT_FR
+    return testResult("utf8_test (FR)");
+#else
+    return testResult("utf8_test");
+#endif
+}
@@ -0,0 +1,126 @@
+#!/bin/sh
+#
+# bench.sh
+#
+# Builds the CycleBenchmark example for the ATmega328P (Uno), runs it
+# in simavr and prints the results with the flash used by each class,
+# one line per result:
+#
+#   <commit> <mcu> <key> <value>
+#
+# e.g. "3f2a1c0 atmega328p keyboard_press.cycles <n>". The lines can be
+# appended to a file to keep a history (-o), and -c compares the last
+# two commits in such a file and prints the results that changed.
+#
+# Needs arduino-cli (with the arduino:avr core), simavr and avr-nm on
+# the path. The library directory is passed to arduino-cli, so the
+# libraries don't have to be installed.
+#
+# Other boards can be given with -b. The Leonardo
+# (arduino:avr:leonardo:atmega32u4) builds, but its core brings up USB
+# at power up, which simavr doesn't emulate fully, so the sketch may
+# never get as far as printing anything there.
+#
+# Usage:
+#   bench.sh [-o <history file>] [-b <fqbn>:<mcu>]...
+#   bench.sh -c <history file>
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+LIBS=$(cd "$HERE/../../.." && pwd)
+SKETCH="$LIBS/HIDGeneric/examples/CycleBenchmark"
+BUILD=${TMPDIR:-/tmp}/hidgeneric-bench
+TIMEOUT=${TIMEOUT:-60}
+
+BOARDS=""
+OUT=""
+
+compare() {
+    # The last two commits in the file, and every key whose value
+    # differs between them
+    awk '
+        { if (!($1 in seen)) { seen[$1] = 1; order[n++] = $1 }
+          value[$1 " " $2 " " $3] = $4 }
+        END {
+            if (n < 2) { print "need two commits to compare"; exit 1 }
+            old = order[n - 2]; new = order[n - 1]
+            for (k in value) {
+                split(k, f, " ")
+                if (f[1] != new) continue
+                o = value[old " " f[2] " " f[3]]
+                if (o != "" && o != value[k])
+                    printf "%s %s %s -> %s\n", f[2], f[3], o, value[k]
+            }
+        }' "$1" | sort
+}
+
+while getopts "o:b:c:" opt; do
+    case $opt in
+        o) OUT=$OPTARG ;;
+        b) BOARDS="$BOARDS $OPTARG" ;;
+        c) compare "$OPTARG"; exit $? ;;
+        *) sed -n '3,28p' "$0"; exit 1 ;;
+    esac
+done
+
+[ -n "$BOARDS" ] || BOARDS="arduino:avr:uno:atmega328p"
+
+for tool in arduino-cli simavr avr-nm avr-size; do
+    command -v $tool >/dev/null 2>&1 || {
+        echo "$tool is not on the path" >&2
+        exit 1
+    }
+done
+
+COMMIT=$(git -C "$LIBS" rev-parse --short HEAD 2>/dev/null || echo unknown)
+if [ -n "$(git -C "$LIBS" status --porcelain -- HIDGeneric RN42 2>/dev/null)" ]; then
+    COMMIT="$COMMIT+"
+fi
+
+for board in $BOARDS; do
+    mcu=${board##*:}
+    fqbn=${board%:*}
+    dir="$BUILD/$mcu"
+    mkdir -p "$dir"
+
+    arduino-cli compile --fqbn "$fqbn" --libraries "$LIBS" \
+        --build-path "$dir" "$SKETCH" >"$dir.log" 2>&1 || {
+        echo "build for $mcu failed, see $dir.log" >&2
+        exit 1
+    }
+    elf="$dir/CycleBenchmark.ino.elf"
+
+    # Results from the sketch - only the key=value lines, simavr's own
+    # output is dropped
+    timeout "$TIMEOUT" simavr -m "$mcu" -f 16000000 "$elf" >"$dir.out" 2>&1 || true
+    sed 's/\x1b\[[0-9;]*m//g; s/\r//g' "$dir.out" >"$dir.txt"
+    grep -q '^done=1$' "$dir.txt" || {
+        echo "no results from simavr for $mcu, see $dir.out" >&2
+        exit 1
+    }
+    sed -n 's/^\([a-z_]*\.[A-Za-z0-9_:<>]*\)=\([0-9]*\)$/\1 \2/p' "$dir.txt" |
+        awk -v c="$COMMIT" -v m="$mcu" '{ print c, m, $1, $2 }' |
+        tee -a "${OUT:-/dev/null}"
+
+    # Flash (text) per class, from the demangled symbol sizes
+    avr-nm -C --size-sort -S -t d "$elf" |
+        awk '$3 ~ /^[tTwW]$/ {
+                name = $0; sub(/^[^ ]+ [^ ]+ [^ ]+ /, "", name)
+                sub(/\(.*/, "", name)
+                n = split(name, part, "::")
+                if (n < 2) next
+                cls = part[1]; for (i = 2; i < n; i++) cls = cls "::" part[i]
+                sub(/<.*/, "", cls)
+                size[cls] += $2
+             }
+             END { for (c in size) print c, size[c] }' |
+        sort |
+        awk -v c="$COMMIT" -v m="$mcu" '{ print c, m, "flash." $1, $2 }' |
+        tee -a "${OUT:-/dev/null}"
+
+    # Totals
+    avr-size "$elf" | awk -v c="$COMMIT" -v m="$mcu" 'NR == 2 {
+        print c, m, "total.flash", $1 + $2
+        print c, m, "total.ram", $2 + $3 }' | tee -a "${OUT:-/dev/null}"
+done
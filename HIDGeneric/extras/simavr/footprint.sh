@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# footprint.sh
+#
+# Builds the Footprint example with each of its device lists and prints
+# the flash and static RAM used, as reported by avr-size:
+#
+#   <mcu> <devices> flash <bytes>
+#   <mcu> <devices> ram <bytes>
+#
+# Needs arduino-cli (with the arduino:avr core) and avr-size on the
+# path. Nothing is run, so simavr isn't needed.
+#
+# Usage:
+#   footprint.sh [-b <fqbn>:<mcu>]...
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+LIBS=$(cd "$HERE/../../.." && pwd)
+SKETCH="$LIBS/HIDGeneric/examples/Footprint"
+BUILD=${TMPDIR:-/tmp}/hidgeneric-footprint
+
+BOARDS=""
+
+while getopts "b:" opt; do
+    case $opt in
+        b) BOARDS="$BOARDS $OPTARG" ;;
+        *) sed -n '3,15p' "$0"; exit 1 ;;
+    esac
+done
+
+[ -n "$BOARDS" ] || BOARDS="arduino:avr:uno:atmega328p arduino:avr:leonardo:atmega32u4"
+
+for board in $BOARDS; do
+    mcu=${board##*:}
+    fqbn=${board%:*}
+    # The DEVICES values in Footprint.ino
+    for devices in 0 1 2 3 4; do
+        case $devices in
+            0) name=mouse+keyboard ;;
+            1) name=keyboard ;;
+            2) name=mouse ;;
+            3) name=consumer ;;
+            4) name=gamepad ;;
+        esac
+        dir="$BUILD/$mcu-$devices"
+        mkdir -p "$dir"
+
+        arduino-cli compile --fqbn "$fqbn" --libraries "$LIBS" \
+            --build-property "compiler.cpp.extra_flags=-DDEVICES=$devices" \
+            --build-path "$dir" "$SKETCH" >"$dir.log" 2>&1 || {
+            echo "build for $mcu $name failed, see $dir.log" >&2
+            exit 1
+        }
+        avr-size "$dir/Footprint.ino.elf" | awk -v m="$mcu" -v d="$name" 'NR == 2 {
+            print m, d, "flash", $1 + $2
+            print m, d, "ram", $2 + $3 }'
+    done
+done
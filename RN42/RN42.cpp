@@ -19,5 +19,37 @@
 #include "RN42.h"
 
 
+// RN42ConsumerMap Methods
+
+// Consumer page usage of each bit of the module's consumer report
+const uint16_t RN42ConsumerMap::usages_m[16] PROGMEM = {
+    0x0223, 0x018A, 0x0221, 0x01AE, 0x00E9, 0x00EA, 0x00E2, 0x00CD,
+    0x00B5, 0x00B6, 0x00B7, 0x00B8, 0x00B3, 0x00B4, 0x00CC, 0x0196
+};
+
+uint16_t
+RN42ConsumerMap::toBitmap(
+    const uint8_t* report,
+    uint32_t len
+)
+{
+    uint16_t bits = 0;
+
+    for (uint32_t i = 0; i + 1 < len; i += 2) {
+        uint16_t usage = report[i] | (report[i+1] << 8);
+        if (!usage) {
+            continue;
+        }
+        for (uint8_t bit = 0; bit < 16; bit++) {
+            if (pgm_read_word(&usages_m[bit]) == usage) {
+                bits |= 1 << bit;
+                break;
+            }
+        }
+    }
+    return bits;
+}
+
+
 
 
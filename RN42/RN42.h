@@ -67,8 +67,157 @@
 //
 // See the HIDGeneric docs for more info.
 //
+// The HID profile the module presents to the host is chosen with
+// the second template argument (the combo keyboard and mouse profile
+// is used by default):
+//
+//   RN42<typeof Serial3, RN42KeyboardProfile> rn42Obj(Serial3);
+//
+
+
+// Debug output
+//
+// Define RN42_DEBUG before including this header to have the commands,
+// replies and report bytes echoed on Serial. It is off by default since
+// the echo costs far more time than sending the report itself.
+//#define RN42_DEBUG
+
+#ifdef RN42_DEBUG
+#define RN42_DEBUG_PRINT(x)   Serial.print(x)
+#define RN42_DEBUG_PRINTLN(x) Serial.println(x)
+#else
+#define RN42_DEBUG_PRINT(x)
+#define RN42_DEBUG_PRINTLN(x)
+#endif
+
+
+// Compile time assertion - fails to compile with a negative array
+// size when the condition is false
+#define RN42_STATIC_ASSERT(cond, name) typedef char rn42_assert_##name[(cond) ? 1 : -1]
+
+
+// RN42 HID profiles
+//
+// Each profile gives the SH flags that select it on the module and the
+// raw report IDs the module expects for each kind of report while it
+// is active. A report ID of 0 means the profile can't carry that report.
+//
+// SH flags: bit 9 forces HID mode, bits 6-4 select the descriptor.
+//
+// None of the profiles carry the HIDGeneric gamepad report - the
+// module's own gamepad descriptor has a different layout. Consumer
+// reports are translated, see RN42ConsumerMap.
+
+struct RN42KeyboardProfile {
+    static const uint16_t SH_FLAGS           = 0x0200;
+    static const uint8_t  KEYBOARD_REPORT_ID = 1;
+    static const uint8_t  MOUSE_REPORT_ID    = 0;
+    static const uint8_t  CONSUMER_REPORT_ID = 3;
+    static const uint8_t  GAMEPAD_REPORT_ID  = 0;
+};
+
+struct RN42MouseProfile {
+    static const uint16_t SH_FLAGS           = 0x0220;
+    static const uint8_t  KEYBOARD_REPORT_ID = 0;
+    static const uint8_t  MOUSE_REPORT_ID    = 2;
+    static const uint8_t  CONSUMER_REPORT_ID = 0;
+    static const uint8_t  GAMEPAD_REPORT_ID  = 0;
+};
+
+struct RN42ComboProfile {
+    static const uint16_t SH_FLAGS           = 0x0230;
+    static const uint8_t  KEYBOARD_REPORT_ID = 1;
+    static const uint8_t  MOUSE_REPORT_ID    = 2;
+    static const uint8_t  CONSUMER_REPORT_ID = 3;
+    static const uint8_t  GAMEPAD_REPORT_ID  = 0;
+};
+
+
+// RN42ConsumerMap
+//
+// The module's consumer report is not the HIDGeneric array of usages
+// but a fixed 16 bit bitmap, one bit per key:
+//
+//   bit  0 AC Home          bit  8 Scan Next Track
+//   bit  1 AL Email Reader  bit  9 Scan Previous Track
+//   bit  2 AC Search        bit 10 Stop
+//   bit  3 AL Keyboard Lay. bit 11 Eject
+//   bit  4 Volume Up        bit 12 Fast Forward
+//   bit  5 Volume Down      bit 13 Rewind
+//   bit  6 Mute             bit 14 Stop/Eject
+//   bit  7 Play/Pause       bit 15 AL Internet Browser
+//
+// Usages with no bit (brightness, calculator, ...) are dropped.
+class RN42ConsumerMap {
+  public:
+    // Bitmap for the 16 bit little endian usages in report
+    static uint16_t toBitmap(const uint8_t* report, uint32_t len);
+
+  private:
+    static const uint16_t usages_m[16];
+};
+
+
+// RN42ReportMap
+//
+// Translates the report IDs from the HIDGeneric descriptor into the ones
+// used by the module's profile. The table is built at compile time from
+// the profile, so sending a report costs a single lookup on the first
+// byte rather than a test on every byte of the frame. New report types
+// only need a profile entry and a slot in the table.
+template <typename Profile>
+class RN42ReportMap {
+  public:
+
+    // HIDGeneric report ID to module report ID (0 if not supported)
+    static uint8_t toModule(uint8_t id) {
+        return id < TABLE_SIZE ? table_m[id] : 0;
+    }
+
+    // Module report ID back to the HIDGeneric one (0 if unknown)
+    static uint8_t fromModule(uint8_t id) {
+        for (uint8_t i = 1; id && i < TABLE_SIZE; i++) {
+            if (table_m[i] == id) {
+                return i;
+            }
+        }
+        return 0;
+    }
+
+  private:
+
+    static const uint8_t TABLE_SIZE = 5;
+
+    // The table below is laid out in HIDGeneric report ID order
+    RN42_STATIC_ASSERT(HIDGenericImpl::MOUSE_REPORT_ID == 1, mouse_report_id);
+    RN42_STATIC_ASSERT(HIDGenericImpl::KEYBOARD_REPORT_ID == 2, keyboard_report_id);
+    RN42_STATIC_ASSERT(HIDGenericImpl::CONSUMER_REPORT_ID == 3, consumer_report_id);
+    RN42_STATIC_ASSERT(HIDGenericImpl::GAMEPAD_REPORT_ID == 4, gamepad_report_id);
+    RN42_STATIC_ASSERT(HIDGenericImpl::MAX_REPORT_ID == TABLE_SIZE - 1, report_table_size);
+
+    // Two reports can't share a module report ID
+    RN42_STATIC_ASSERT(Profile::MOUSE_REPORT_ID == 0 ||
+                       (Profile::MOUSE_REPORT_ID != Profile::KEYBOARD_REPORT_ID &&
+                        Profile::MOUSE_REPORT_ID != Profile::CONSUMER_REPORT_ID),
+                       distinct_report_ids);
+    RN42_STATIC_ASSERT(Profile::CONSUMER_REPORT_ID == 0 ||
+                       Profile::CONSUMER_REPORT_ID != Profile::KEYBOARD_REPORT_ID,
+                       distinct_consumer_report_id);
+
+    static const uint8_t table_m[TABLE_SIZE];
+};
+
+template <typename Profile>
+const uint8_t RN42ReportMap<Profile>::table_m[RN42ReportMap<Profile>::TABLE_SIZE] = {
+    0,
+    Profile::MOUSE_REPORT_ID,
+    Profile::KEYBOARD_REPORT_ID,
+    Profile::CONSUMER_REPORT_ID,
+    Profile::GAMEPAD_REPORT_ID
+};
+
 
-template <typename SerialClass>
+template <typename SerialClass, typename Profile = RN42ComboProfile>
 class RN42 {
     public:
     
@@ -78,20 +227,44 @@ class RN42 {
     // Initialization routine
     //
     // speed: baud rate of serial connection
-    void begin(uint32_t speed);
+    //
+    // Selects the HID profile on the module and reboots it. Returns
+    // false if the module didn't enter command mode or refused the
+    // profile.
+    bool begin(uint32_t speed);
 
     // Methods required to be compatible with the HIDGeneric library
     void sendReport(const void* data, uint32_t len);
     void sendControl(uint8_t flags, const void* data, uint32_t len);
+    int receiveReport(void* data, uint32_t len);
+
+    // Command mode
+    //
+    // sendCommand() returns the first line of the reply, or whatever
+    // arrived before COMMAND_TIMEOUT_MS ran out if the module didn't
+    // answer.
+    static const uint32_t COMMAND_TIMEOUT_MS = 1000;
 
     bool enterCommandMode();
     void exitCommandMode();
     String sendCommand(const String& command);
 
   private:
+
+    typedef RN42ReportMap<Profile> ReportMap;
+
+    // Receive states for output reports coming from the module
+    static const uint8_t RX_IDLE   = 0;
+    static const uint8_t RX_LENGTH = 1;
+    static const uint8_t RX_DATA   = 2;
+    static const uint8_t RX_BUFFER_SIZE = 16;
     
     // RN42 data members
     SerialClass&  serial_m;
+    uint8_t       rxState_m;
+    uint8_t       rxLen_m;
+    uint8_t       rxPos_m;
+    uint8_t       rxBuf_m[RX_BUFFER_SIZE];
 };
 
 
@@ -100,50 +273,56 @@ class RN42 {
 
 // RN42 Methods
 
-template <typename SerialClass>
-RN42<SerialClass>::RN42(SerialClass& serial) :
-    serial_m(serial)
+template <typename SerialClass, typename Profile>
+RN42<SerialClass, Profile>::RN42(SerialClass& serial) :
+    serial_m(serial),
+    rxState_m(RX_IDLE),
+    rxLen_m(0),
+    rxPos_m(0)
 {
 
 }
 
 
-template <typename SerialClass>
+template <typename SerialClass, typename Profile>
 String
-RN42<SerialClass>::sendCommand(
+RN42<SerialClass, Profile>::sendCommand(
     const String& command
 )
 {
-    Serial.print("Sending command: ");
-    Serial.println(command);
+    RN42_DEBUG_PRINT("Sending command: ");
+    RN42_DEBUG_PRINTLN(command);
 
     serial_m.print(command);
 
     String response;
-    while (true) {
+    uint32_t start = millis();
+    while (millis() - start < COMMAND_TIMEOUT_MS) {
         if (serial_m.available()) {
             char val = serial_m.read();
-            Serial.print("rx char: ");
-            Serial.println(val);
+            RN42_DEBUG_PRINT("rx char: ");
+            RN42_DEBUG_PRINTLN(val);
             if (val == 13) {
                 break;
             }
-            else {
+            else if (val != 10) {
+                // Replies end in CR LF - the LF of the previous reply
+                // is still waiting when the next command is sent
                 response += val;
             }
         }
     }
 
-    Serial.print("Response: ");
-    Serial.println(response);
+    RN42_DEBUG_PRINT("Response: ");
+    RN42_DEBUG_PRINTLN(response);
 
     return response;
 }
 
 
-template <typename SerialClass>
+template <typename SerialClass, typename Profile>
 bool
-RN42<SerialClass>::enterCommandMode()
+RN42<SerialClass, Profile>::enterCommandMode()
 {
     // Disconnect - if connected
     serial_m.write((uint8_t)0);
@@ -159,9 +338,9 @@ RN42<SerialClass>::enterCommandMode()
 
 }
 
-template <typename SerialClass>
+template <typename SerialClass, typename Profile>
 void
-RN42<SerialClass>::exitCommandMode()
+RN42<SerialClass, Profile>::exitCommandMode()
 {
 
     sendCommand("---\r");
@@ -170,62 +349,130 @@ RN42<SerialClass>::exitCommandMode()
 
 
 
-template <typename SerialClass>
-void 
-RN42<SerialClass>::begin(
+template <typename SerialClass, typename Profile>
+bool
+RN42<SerialClass, Profile>::begin(
     uint32_t serialSpeed
 )
 {
-    Serial.println("Initializing bluetooth...");
-    return;
+    RN42_DEBUG_PRINTLN("Initializing bluetooth...");
     if (!enterCommandMode()) {
-        // TODO - add error here
-        return;
+        // Either the module isn't there or the config timer has run
+        // out - command mode is only allowed for 60 seconds after
+        // power up unless the module is told otherwise (ST,255)
+        return false;
     }
 
-    sendCommand("SH,0230\r");
+    // Select the HID profile
+    static const char hex[] = "0123456789ABCDEF";
+    char command[] = "SH,0000\r";
+    for (uint8_t i = 0; i < 4; i++) {
+        command[6-i] = hex[(Profile::SH_FLAGS >> (4*i)) & 0xf];
+    }
+    if (sendCommand(command) != "AOK") {
+        exitCommandMode();
+        return false;
+    }
     sendCommand("CFR\r");
 
     exitCommandMode();
+    return true;
 }
 
 
-template <typename SerialClass>
+template <typename SerialClass, typename Profile>
 void 
-RN42<SerialClass>::sendReport(
+RN42<SerialClass, Profile>::sendReport(
     const void* data, 
     uint32_t len
 )
 {
-    Serial.print("Sending a report of length: ");
-    Serial.println(len);
+    RN42_DEBUG_PRINT("Sending a report of length: ");
+    RN42_DEBUG_PRINTLN(len);
+
+    const uint8_t* data_p = (const uint8_t*)data;
+    if (!len) {
+        return;
+    }
+
+    // The first byte is the report ID, which has to be translated
+    // into the one the module uses for this profile
+    uint8_t id = ReportMap::toModule(data_p[0]);
+    if (!id) {
+        RN42_DEBUG_PRINTLN("Report not supported by the RN42 profile");
+        return;
+    }
+
+    if (data_p[0] == HIDGenericImpl::CONSUMER_REPORT_ID) {
+        uint16_t bits = RN42ConsumerMap::toBitmap(data_p + 1, len - 1);
+        serial_m.write(0xfd);
+        serial_m.write(3);
+        serial_m.write(id);
+        serial_m.write(bits & 0xff);
+        serial_m.write(bits >> 8);
+        return;
+    }
 
     serial_m.write(0xfd);
     serial_m.write(len);
+    serial_m.write(id);
 
-    // The HID class gives the descriptor backwards...
-    // TODO: Figure this out
+    for (uint32_t i = 1; i < len; i++) {
+        RN42_DEBUG_PRINT("Sending char: ");
+        RN42_DEBUG_PRINTLN(data_p[i]);
+        serial_m.write(data_p[i]);
+    }
+}
 
-    const uint8_t* data_p = (const uint8_t*)data;
-    for (uint32_t i = 0; i < len; i++) {
-        Serial.print("Sending char: ");
-        uint8_t val = data_p[i];
-        if (i == 0) {
-            if (val == 1) {
-                val = 2;
+// Output reports from the host (keyboard LEDs) are passed up by the
+// module using the same framing as the raw reports we send: 0xfd,
+// length, report ID and data. This never blocks - it only consumes
+// what is already sitting in the serial buffer and returns 0 until a
+// complete report has been seen.
+template <typename SerialClass, typename Profile>
+int
+RN42<SerialClass, Profile>::receiveReport(
+    void* data,
+    uint32_t len
+)
+{
+    while (serial_m.available()) {
+        uint8_t val = serial_m.read();
+
+        if (rxState_m == RX_IDLE) {
+            if (val == 0xfd) {
+                rxState_m = RX_LENGTH;
             }
-            else if (val == 2) {
-                val = 1;
+        }
+        else if (rxState_m == RX_LENGTH) {
+            rxLen_m   = val;
+            rxPos_m   = 0;
+            rxState_m = val ? RX_DATA : RX_IDLE;
+        }
+        else {
+            if (rxPos_m < RX_BUFFER_SIZE) {
+                if (rxPos_m == 0) {
+                    val = ReportMap::fromModule(val);
+                }
+                rxBuf_m[rxPos_m] = val;
+            }
+            if (++rxPos_m == rxLen_m) {
+                rxState_m = RX_IDLE;
+                uint32_t n = rxLen_m < RX_BUFFER_SIZE ? rxLen_m : RX_BUFFER_SIZE;
+                if (n > len) {
+                    n = len;
+                }
+                memcpy(data, rxBuf_m, n);
+                return rxLen_m;
             }
         }
-        Serial.println(val);
-        serial_m.write(val);
     }
+    return 0;
 }
 
-template <typename SerialClass>
+template <typename SerialClass, typename Profile>
 void 
-RN42<SerialClass>::sendControl(
+RN42<SerialClass, Profile>::sendControl(
     uint8_t flags, 
     const void* data, 
     uint32_t len
@@ -233,7 +480,12 @@ RN42<SerialClass>::sendControl(
 {
     const uint8_t* data_p = (const uint8_t*)data;
     for (uint32_t i = 0; i < len; i++) {
-        serial_m.write(data_p[i]);
+        if (flags & HIDGenericImpl::TRANSFER_PGM) {
+            serial_m.write(pgm_read_byte(data_p + i));
+        }
+        else {
+            serial_m.write(data_p[i]);
+        }
     }
 }
 
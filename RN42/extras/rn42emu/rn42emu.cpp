@@ -0,0 +1,744 @@
+/*
+** Copyright (c) 2014, Edward Funnekotter
+**
+** Permission to use, copy, modify, and/or distribute this software for
+** any purpose with or without fee is hereby granted, provided that the
+** above copyright notice and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+** WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+** BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+** OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+** WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+** SOFTWARE.
+*/
+
+// rn42emu
+//
+// Host side emulator of an RN-42 HID module (Blue SMiRF HID) for
+// testing the RN42 library without the hardware. It runs on Linux and
+// either creates a pseudo terminal (the default - the slave path is
+// printed on startup) or attaches to an existing serial device, such
+// as a USB serial adapter wired to the Arduino's UART.
+//
+// Build:
+//   g++ -O2 -Wall -o rn42emu rn42emu.cpp
+//
+// Usage:
+//   rn42emu [options]
+//     -t <device>    use this serial device instead of a new pty
+//     -b <baud>      simulated UART speed (default 115200, at most
+//                    10000000 so a byte takes at least a microsecond)
+//     -c <ms>        command reply delay (default 20)
+//     -r <percent>   drop this percentage of command replies
+//     -d <every>,<for>
+//                    drop the host link every <every> ms for <for> ms;
+//                    reports sent while it is down are counted as lost
+//     -l <leds>      send this keyboard LED output report on connect
+//     -s <seconds>   print statistics periodically
+//     -v             print every decoded report
+//
+// What is emulated:
+//   - "$$$" enters command mode ("CMD"), "---" leaves it ("END")
+//   - SH, SU, SN, S~, SM, GH, D, V, CFR, R,1 and friends, with AOK/?
+//     replies after the reply delay. R,1 answers "Reboot!" and drops
+//     back to data mode after the reboot time
+//   - 0xfd raw report frames are decoded into keyboard, mouse and
+//     consumer (16 bit key bitmap) reports; anything else in data
+//     mode is treated as ASCII typed by the module
+//   - the incoming byte rate is limited to the UART speed, so a
+//     sender that is too fast is held back just as with the module
+//
+// Statistics (keystrokes per second, report counts, frame times on the
+// wire, lost reports) are printed as "key=value" lines on exit (Ctrl-C)
+// and every -s seconds, so they can be picked up by scripts.
+// rn42test.sh uses them to check the library against the emulator.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+
+// RN-42 raw report IDs (combo profile)
+static const uint8_t KEYBOARD_REPORT_ID = 1;
+static const uint8_t MOUSE_REPORT_ID    = 2;
+static const uint8_t CONSUMER_REPORT_ID = 3;
+
+static const uint32_t REBOOT_TIME_MS = 500;
+
+// Fastest UART that can be simulated - the byte time is kept in whole
+// microseconds
+static const uint32_t MAX_BAUD = 10000000;
+
+static volatile sig_atomic_t stop_g = 0;
+
+static void
+onSignal(int)
+{
+    stop_g = 1;
+}
+
+// Monotonic time in microseconds
+static uint64_t
+nowUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+struct Options {
+    Options() :
+        device(NULL),
+        baud(115200),
+        replyDelayMs(20),
+        dropPercent(0),
+        disconnectEveryMs(0),
+        disconnectForMs(0),
+        leds(-1),
+        statsSeconds(0),
+        verbose(false) {}
+
+    const char* device;
+    uint32_t    baud;
+    uint32_t    replyDelayMs;
+    uint32_t    dropPercent;
+    uint32_t    disconnectEveryMs;
+    uint32_t    disconnectForMs;
+    int         leds;
+    uint32_t    statsSeconds;
+    bool        verbose;
+};
+
+
+// Emulator class
+//
+// Byte level state machine for the module. All input comes through
+// input() and all output goes through reply()/transmit().
+class Emulator {
+  public:
+    Emulator(int fd, const Options& options);
+
+    void run();
+    void printStats();
+
+  private:
+
+    // Frame parser states in data mode
+    static const uint8_t RX_IDLE   = 0;
+    static const uint8_t RX_LENGTH = 1;
+    static const uint8_t RX_DATA   = 2;
+
+    void input(uint8_t c, uint64_t wireTime);
+    void dataByte(uint8_t c, uint64_t wireTime);
+    void commandByte(uint8_t c);
+    void command(const std::string& cmd);
+    void frame();
+    void keyboardReport(const uint8_t* data, uint8_t len);
+    void mouseReport(const uint8_t* data, uint8_t len);
+    void consumerReport(const uint8_t* data, uint8_t len);
+    void reply(const char* text);
+    void transmit(const uint8_t* data, size_t len);
+    bool linkUp(uint64_t now);
+    void connected();
+
+    int       fd_m;
+    Options   options_m;
+    uint64_t  byteTimeUs_m;
+
+    // Mode and parser state
+    bool      commandMode_m;
+    uint8_t   dollars_m;
+    std::string line_m;
+    uint8_t   rxState_m;
+    uint8_t   rxLen_m;
+    uint8_t   rxPos_m;
+    uint8_t   rxBuf_m[256];
+    uint64_t  frameStart_m;
+    uint64_t  frameEnd_m;
+    uint64_t  rebootUntil_m;
+    uint16_t  shFlags_m;
+    bool      wasUp_m;
+
+    // Last keyboard report, to spot new key presses
+    uint8_t   lastKeys_m[6];
+    uint8_t   lastModifiers_m;
+
+    // Statistics
+    uint64_t  start_m;
+    uint64_t  bytes_m;
+    uint64_t  frames_m;
+    uint64_t  keyboardReports_m;
+    uint64_t  mouseReports_m;
+    uint64_t  consumerReports_m;
+    uint64_t  unknownReports_m;
+    uint64_t  keystrokes_m;
+    uint64_t  asciiChars_m;
+    uint64_t  lostReports_m;
+    uint64_t  commands_m;
+    uint64_t  droppedReplies_m;
+    uint64_t  frameTimeTotal_m;
+    uint64_t  frameTimeMax_m;
+    uint64_t  frameGapMin_m;
+};
+
+
+Emulator::Emulator(int fd, const Options& options) :
+    fd_m(fd),
+    options_m(options),
+    byteTimeUs_m(0),
+    commandMode_m(false),
+    dollars_m(0),
+    rxState_m(RX_IDLE),
+    rxLen_m(0),
+    rxPos_m(0),
+    frameStart_m(0),
+    frameEnd_m(0),
+    rebootUntil_m(0),
+    shFlags_m(0x0230),
+    wasUp_m(false),
+    lastModifiers_m(0),
+    start_m(nowUs()),
+    bytes_m(0),
+    frames_m(0),
+    keyboardReports_m(0),
+    mouseReports_m(0),
+    consumerReports_m(0),
+    unknownReports_m(0),
+    keystrokes_m(0),
+    asciiChars_m(0),
+    lostReports_m(0),
+    commands_m(0),
+    droppedReplies_m(0),
+    frameTimeTotal_m(0),
+    frameTimeMax_m(0),
+    frameGapMin_m((uint64_t)-1)
+{
+    // 8N1 - ten bits on the wire per byte
+    byteTimeUs_m = 10000000ULL / options_m.baud;
+    memset(lastKeys_m, 0, sizeof(lastKeys_m));
+}
+
+// The link to the host goes down periodically when -d is given
+bool
+Emulator::linkUp(uint64_t now)
+{
+    if (!options_m.disconnectEveryMs) {
+        return true;
+    }
+    uint64_t period = (uint64_t)(options_m.disconnectEveryMs + options_m.disconnectForMs) * 1000;
+    return (now - start_m) % period < (uint64_t)options_m.disconnectEveryMs * 1000;
+}
+
+void
+Emulator::connected()
+{
+    if (options_m.verbose) {
+        printf("CONNECT\n");
+    }
+    if (options_m.leds >= 0) {
+        uint8_t report[4] = {0xfd, 2, KEYBOARD_REPORT_ID, (uint8_t)options_m.leds};
+        transmit(report, sizeof(report));
+    }
+}
+
+void
+Emulator::run()
+{
+    uint64_t budgetStart = nowUs();
+    uint64_t consumed    = 0;
+    uint64_t lastStats   = budgetStart;
+
+    while (!stop_g) {
+        uint64_t now = nowUs();
+
+        bool up = linkUp(now);
+        if (up != wasUp_m) {
+            wasUp_m = up;
+            if (up) {
+                connected();
+            }
+            else if (options_m.verbose) {
+                printf("DISCONNECT\n");
+            }
+        }
+
+        if (options_m.statsSeconds &&
+            now - lastStats >= (uint64_t)options_m.statsSeconds * 1000000) {
+            printStats();
+            lastStats = now;
+        }
+
+        // Only take as many bytes as the UART could have delivered
+        // by now. Idle time doesn't build up credit.
+        uint64_t allowed = (now - budgetStart) / byteTimeUs_m;
+        if (allowed <= consumed) {
+            usleep(byteTimeUs_m > 1000 ? 1000 : byteTimeUs_m);
+            continue;
+        }
+        size_t room = (size_t)(allowed - consumed);
+
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(fd_m, &fds);
+        struct timeval tv = {0, 10000};
+        int ready = select(fd_m + 1, &fds, NULL, NULL, &tv);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("select");
+            break;
+        }
+        if (!ready) {
+            budgetStart = nowUs();
+            consumed    = 0;
+            continue;
+        }
+
+        uint8_t buf[256];
+        ssize_t n = read(fd_m, buf, room < sizeof(buf) ? room : sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EIO) {
+                // EIO: nobody has the pty open right now
+                usleep(10000);
+                continue;
+            }
+            perror("read");
+            break;
+        }
+
+        for (ssize_t i = 0; i < n; i++) {
+            // Time the byte finished arriving on the simulated wire
+            input(buf[i], budgetStart + (consumed + i + 1) * byteTimeUs_m);
+        }
+        consumed += n;
+    }
+}
+
+void
+Emulator::input(uint8_t c, uint64_t wireTime)
+{
+    bytes_m++;
+
+    if (rebootUntil_m) {
+        if (wireTime < rebootUntil_m) {
+            // Bytes sent while the module reboots are lost
+            return;
+        }
+        rebootUntil_m = 0;
+    }
+
+    if (commandMode_m) {
+        commandByte(c);
+    }
+    else {
+        dataByte(c, wireTime);
+    }
+}
+
+void
+Emulator::dataByte(uint8_t c, uint64_t wireTime)
+{
+    if (rxState_m == RX_IDLE) {
+        if (c == 0xfd) {
+            rxState_m    = RX_LENGTH;
+            frameStart_m = wireTime - byteTimeUs_m;
+            dollars_m    = 0;
+            return;
+        }
+        if (c == '$') {
+            if (++dollars_m == 3) {
+                dollars_m     = 0;
+                commandMode_m = true;
+                line_m.clear();
+                reply("CMD\r\n");
+            }
+            return;
+        }
+        dollars_m = 0;
+        if (c == 0) {
+            // Sent by RN42::enterCommandMode - nothing to type
+            return;
+        }
+        // Plain ASCII is typed by the module
+        asciiChars_m++;
+        keystrokes_m++;
+        if (options_m.verbose) {
+            printf("ASCII 0x%02x\n", c);
+        }
+        return;
+    }
+
+    if (rxState_m == RX_LENGTH) {
+        rxLen_m   = c;
+        rxPos_m   = 0;
+        rxState_m = c ? RX_DATA : RX_IDLE;
+        return;
+    }
+
+    rxBuf_m[rxPos_m++] = c;
+    if (rxPos_m == rxLen_m) {
+        rxState_m = RX_IDLE;
+
+        uint64_t wire = wireTime - frameStart_m;
+        frameTimeTotal_m += wire;
+        if (wire > frameTimeMax_m) {
+            frameTimeMax_m = wire;
+        }
+        if (frameEnd_m && frameStart_m - frameEnd_m < frameGapMin_m) {
+            frameGapMin_m = frameStart_m - frameEnd_m;
+        }
+        frameEnd_m = wireTime;
+
+        frame();
+    }
+}
+
+void
+Emulator::frame()
+{
+    frames_m++;
+
+    if (!linkUp(frameEnd_m)) {
+        lostReports_m++;
+        return;
+    }
+
+    const uint8_t* data = rxBuf_m + 1;
+    uint8_t len = rxLen_m - 1;
+
+    switch (rxBuf_m[0]) {
+    case KEYBOARD_REPORT_ID:
+        keyboardReport(data, len);
+        break;
+    case MOUSE_REPORT_ID:
+        mouseReport(data, len);
+        break;
+    case CONSUMER_REPORT_ID:
+        consumerReport(data, len);
+        break;
+    default:
+        unknownReports_m++;
+        if (options_m.verbose) {
+            printf("UNKNOWN id=%u len=%u\n", rxBuf_m[0], len);
+        }
+        break;
+    }
+}
+
+void
+Emulator::keyboardReport(const uint8_t* data, uint8_t len)
+{
+    if (len != 8) {
+        unknownReports_m++;
+        return;
+    }
+    keyboardReports_m++;
+
+    const uint8_t* keys = data + 2;
+    for (int i = 0; i < 6; i++) {
+        if (!keys[i]) {
+            continue;
+        }
+        bool held = false;
+        for (int j = 0; j < 6; j++) {
+            held = held || lastKeys_m[j] == keys[i];
+        }
+        if (!held) {
+            keystrokes_m++;
+        }
+    }
+    memcpy(lastKeys_m, keys, 6);
+    lastModifiers_m = data[0];
+
+    if (options_m.verbose) {
+        printf("KEYBOARD mods=0x%02x keys=%02x %02x %02x %02x %02x %02x\n",
+               data[0], keys[0], keys[1], keys[2], keys[3], keys[4], keys[5]);
+    }
+}
+
+void
+Emulator::mouseReport(const uint8_t* data, uint8_t len)
+{
+    if (len != 4) {
+        unknownReports_m++;
+        return;
+    }
+    mouseReports_m++;
+
+    if (options_m.verbose) {
+        printf("MOUSE buttons=0x%02x x=%d y=%d wheel=%d\n",
+               data[0], (int8_t)data[1], (int8_t)data[2], (int8_t)data[3]);
+    }
+}
+
+// The module's consumer report is a 16 bit bitmap rather than a list
+// of usages. Each set bit is printed as the usage it stands for.
+void
+Emulator::consumerReport(const uint8_t* data, uint8_t len)
+{
+    static const uint16_t usages[16] = {
+        0x0223, 0x018A, 0x0221, 0x01AE, 0x00E9, 0x00EA, 0x00E2, 0x00CD,
+        0x00B5, 0x00B6, 0x00B7, 0x00B8, 0x00B3, 0x00B4, 0x00CC, 0x0196
+    };
+
+    if (len != 2) {
+        unknownReports_m++;
+        return;
+    }
+    consumerReports_m++;
+
+    if (options_m.verbose) {
+        uint16_t bits = data[0] | (data[1] << 8);
+        printf("CONSUMER");
+        for (uint8_t i = 0; i < 16; i++) {
+            if (bits & (1 << i)) {
+                printf(" 0x%04x", usages[i]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+void
+Emulator::commandByte(uint8_t c)
+{
+    if (c == '\n') {
+        return;
+    }
+    if (c != '\r') {
+        line_m += (char)c;
+        return;
+    }
+    std::string cmd = line_m;
+    line_m.clear();
+    if (!cmd.empty()) {
+        command(cmd);
+    }
+}
+
+void
+Emulator::command(const std::string& cmd)
+{
+    commands_m++;
+    if (options_m.verbose) {
+        printf("COMMAND %s\n", cmd.c_str());
+    }
+
+    if (cmd == "---") {
+        commandMode_m = false;
+        reply("END\r\n");
+    }
+    else if (cmd.compare(0, 3, "SH,") == 0) {
+        shFlags_m = (uint16_t)strtoul(cmd.c_str() + 3, NULL, 16);
+        reply("AOK\r\n");
+    }
+    else if (cmd.compare(0, 3, "SU,") == 0 || cmd.compare(0, 3, "SN,") == 0 ||
+             cmd.compare(0, 3, "S~,") == 0 || cmd.compare(0, 3, "SM,") == 0 ||
+             cmd.compare(0, 3, "SA,") == 0 || cmd.compare(0, 3, "SR,") == 0) {
+        reply("AOK\r\n");
+    }
+    else if (cmd == "GH") {
+        char text[16];
+        snprintf(text, sizeof(text), "%04X\r\n", shFlags_m);
+        reply(text);
+    }
+    else if (cmd == "V") {
+        reply("Ver 6.15 04/26/2013\r\n(c) Roving Networks\r\n");
+    }
+    else if (cmd == "D") {
+        char text[128];
+        snprintf(text, sizeof(text),
+                 "***Settings***\r\nBTA=000000000000\r\nBTName=rn42emu\r\n"
+                 "HidFlags=%X\r\n", shFlags_m);
+        reply(text);
+    }
+    else if (cmd == "CFR" || cmd == "C") {
+        reply("TRYING\r\n");
+    }
+    else if (cmd == "R,1") {
+        reply("Reboot!\r\n");
+        commandMode_m = false;
+        rebootUntil_m = nowUs() + REBOOT_TIME_MS * 1000;
+    }
+    else {
+        reply("?\r\n");
+    }
+}
+
+// Command replies are sent after the reply delay, and may be dropped
+// when fault injection is on
+void
+Emulator::reply(const char* text)
+{
+    if (options_m.dropPercent && (uint32_t)(rand() % 100) < options_m.dropPercent) {
+        droppedReplies_m++;
+        if (options_m.verbose) {
+            printf("DROPPED REPLY %s", text);
+        }
+        return;
+    }
+    usleep(options_m.replyDelayMs * 1000);
+    transmit((const uint8_t*)text, strlen(text));
+}
+
+void
+Emulator::transmit(const uint8_t* data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd_m, data, len);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return;
+        }
+        data += n;
+        len  -= n;
+    }
+}
+
+void
+Emulator::printStats()
+{
+    double seconds = (nowUs() - start_m) / 1e6;
+    uint64_t reports = keyboardReports_m + mouseReports_m + consumerReports_m;
+
+    printf("elapsed_s=%.3f\n", seconds);
+    printf("bytes=%llu\n", (unsigned long long)bytes_m);
+    printf("frames=%llu\n", (unsigned long long)frames_m);
+    printf("keyboard_reports=%llu\n", (unsigned long long)keyboardReports_m);
+    printf("mouse_reports=%llu\n", (unsigned long long)mouseReports_m);
+    printf("consumer_reports=%llu\n", (unsigned long long)consumerReports_m);
+    printf("unknown_reports=%llu\n", (unsigned long long)unknownReports_m);
+    printf("lost_reports=%llu\n", (unsigned long long)lostReports_m);
+    printf("keystrokes=%llu\n", (unsigned long long)keystrokes_m);
+    printf("ascii_chars=%llu\n", (unsigned long long)asciiChars_m);
+    printf("keystrokes_per_s=%.1f\n", seconds > 0 ? keystrokes_m / seconds : 0.0);
+    printf("reports_per_s=%.1f\n", seconds > 0 ? reports / seconds : 0.0);
+    printf("frame_wire_avg_us=%.1f\n", frames_m ? (double)frameTimeTotal_m / frames_m : 0.0);
+    printf("frame_wire_max_us=%llu\n", (unsigned long long)frameTimeMax_m);
+    printf("frame_gap_min_us=%llu\n",
+           (unsigned long long)(frameGapMin_m == (uint64_t)-1 ? 0 : frameGapMin_m));
+    printf("commands=%llu\n", (unsigned long long)commands_m);
+    printf("dropped_replies=%llu\n", (unsigned long long)droppedReplies_m);
+    fflush(stdout);
+}
+
+
+static speed_t
+baudConstant(uint32_t baud)
+{
+    switch (baud) {
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default:     return B115200;
+    }
+}
+
+static void
+usage()
+{
+    fprintf(stderr,
+            "usage: rn42emu [-t device] [-b baud] [-c reply_ms] [-r drop_percent]\n"
+            "               [-d every_ms,for_ms] [-l leds] [-s seconds] [-v]\n");
+    exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+    Options options;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:b:c:r:d:l:s:v")) != -1) {
+        switch (opt) {
+        case 't': options.device       = optarg; break;
+        case 'b': options.baud         = strtoul(optarg, NULL, 0); break;
+        case 'c': options.replyDelayMs = strtoul(optarg, NULL, 0); break;
+        case 'r': options.dropPercent  = strtoul(optarg, NULL, 0); break;
+        case 'l': options.leds         = strtol(optarg, NULL, 0); break;
+        case 's': options.statsSeconds = strtoul(optarg, NULL, 0); break;
+        case 'v': options.verbose      = true; break;
+        case 'd':
+            if (sscanf(optarg, "%u,%u", &options.disconnectEveryMs,
+                       &options.disconnectForMs) != 2) {
+                usage();
+            }
+            break;
+        default:
+            usage();
+        }
+    }
+    if (!options.baud || options.baud > MAX_BAUD) {
+        usage();
+    }
+
+    int fd;
+    int slave = -1;
+    if (options.device) {
+        fd = open(options.device, O_RDWR | O_NOCTTY);
+        if (fd < 0) {
+            perror(options.device);
+            return 1;
+        }
+    }
+    else {
+        fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+            perror("posix_openpt");
+            return 1;
+        }
+        // Keep the slave open so the pty survives clients coming and going
+        slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+        printf("pty=%s\n", ptsname(fd));
+        fflush(stdout);
+    }
+
+    struct termios tio;
+    int tfd = slave >= 0 ? slave : fd;
+    if (tcgetattr(tfd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, baudConstant(options.baud));
+        cfsetospeed(&tio, baudConstant(options.baud));
+        tcsetattr(tfd, TCSANOW, &tio);
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    Emulator emulator(fd, options);
+    emulator.run();
+    emulator.printStats();
+
+    if (slave >= 0) {
+        close(slave);
+    }
+    close(fd);
+    return 0;
+}
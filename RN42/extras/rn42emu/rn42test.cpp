@@ -0,0 +1,137 @@
+/*
+** Copyright (c) 2014, Edward Funnekotter
+**
+** Permission to use, copy, modify, and/or distribute this software for
+** any purpose with or without fee is hereby granted, provided that the
+** above copyright notice and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+** WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+** BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+** OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+** WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+** SOFTWARE.
+*/
+
+// rn42test
+//
+// Drives the RN42 library (through HIDGeneric) against rn42emu over its
+// pty, using the host stand-in for the Arduino core in
+// HIDGeneric/extras/host. Run it with rn42test.sh, which starts the
+// emulator and checks the reports it decoded.
+//
+//   rn42test <pty>
+//
+// Prints "ok" and exits with 0 when every step the library can see for
+// itself went as expected.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "HIDGeneric.h"
+#include "RN42.h"
+
+
+// PtySerial
+//
+// The parts of the Arduino Serial interface RN42 uses, on top of a
+// file descriptor
+class PtySerial {
+  public:
+    PtySerial(int fd) : fd_m(fd) {}
+
+    int available(void) {
+        struct pollfd p = { fd_m, POLLIN, 0 };
+        return poll(&p, 1, 0) > 0 && (p.revents & POLLIN) ? 1 : 0;
+    }
+    int read(void) {
+        uint8_t c;
+        return ::read(fd_m, &c, 1) == 1 ? c : -1;
+    }
+    size_t write(uint8_t c) {
+        return ::write(fd_m, &c, 1) == 1 ? 1 : 0;
+    }
+    void print(const String& s) {
+        for (size_t i = 0; i < s.size(); i++) {
+            write(s[i]);
+        }
+    }
+
+  private:
+    int fd_m;
+};
+
+static int failures_g = 0;
+
+static void
+check(bool ok, const char* what)
+{
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        failures_g++;
+    }
+}
+
+int
+main(int argc, char** argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: rn42test <pty>\n");
+        return 2;
+    }
+
+    int fd = open(argv[1], O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(argv[1]);
+        return 2;
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    // Command timeouts have to run on the wall clock
+    hostRealTime = true;
+
+    PtySerial serial(fd);
+
+    // Command mode on its own
+    RN42<PtySerial, RN42KeyboardProfile> keyboardModule(serial);
+    check(keyboardModule.enterCommandMode(), "enterCommandMode");
+    check(keyboardModule.sendCommand("GH\r") == "0230", "GH before begin");
+    check(keyboardModule.sendCommand("XYZ\r") == "?", "unknown command");
+    keyboardModule.exitCommandMode();
+
+    // begin() selects the profile
+    check(keyboardModule.begin(115200), "begin");
+    check(keyboardModule.enterCommandMode(), "enterCommandMode after begin");
+    check(keyboardModule.sendCommand("GH\r") == "0200", "GH after begin");
+    keyboardModule.exitCommandMode();
+
+    // Reports through HIDGeneric - "Hi" is two key presses and a
+    // release each, with the shift for the H. The media key has to
+    // reach the module as its consumer bitmap.
+    RN42<PtySerial> comboModule(serial);
+    HIDGeneric<RN42<PtySerial>, HIDMouse, HIDKeyboard, HIDConsumerControl> hid(comboModule);
+    hid.begin();
+    hid.getKeyboard().write('H');
+    hid.getKeyboard().write('i');
+    hid.getMouse().move(5, -3);
+    hid.getConsumerControl().tap(HIDGenericImpl::ConsumerControl::CONSUMER_VOLUME_UP);
+
+    // Let the emulator take the frames at its simulated UART speed
+    delay(200);
+    close(fd);
+
+    if (failures_g) {
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
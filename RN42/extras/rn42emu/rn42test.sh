@@ -0,0 +1,68 @@
+#!/bin/sh
+# rn42test.sh
+#
+# Builds rn42emu and rn42test, runs the library against the emulated
+# module and checks what the emulator decoded. Needs g++ on Linux.
+#
+#   ./rn42test.sh
+
+set -e
+
+here=$(cd "$(dirname "$0")" && pwd)
+root=$(cd "$here/../../.." && pwd)
+work=$(mktemp -d)
+trap 'kill $emu 2>/dev/null || true; rm -rf "$work"' EXIT
+
+g++ -O2 -Wall -o "$work/rn42emu" "$here/rn42emu.cpp"
+g++ -O2 -Wall -o "$work/rn42test" \
+    -I"$root/HIDGeneric/extras/host" -I"$root/HIDGeneric" -I"$root/RN42" \
+    "$here/rn42test.cpp" "$root/HIDGeneric/HIDGeneric.cpp" "$root/RN42/RN42.cpp" \
+    "$root/HIDGeneric/extras/host/Arduino.cpp"
+
+# A -b above 10 Mbaud has to be refused
+if "$work/rn42emu" -b 20000000 >/dev/null 2>&1; then
+    echo "FAIL rn42emu accepted -b 20000000"
+    exit 1
+fi
+
+"$work/rn42emu" -c 5 -v >"$work/emu.out" &
+emu=$!
+
+pty=
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    pty=$(sed -n 's/^pty=//p' "$work/emu.out")
+    [ -n "$pty" ] && break
+    sleep 0.1
+done
+if [ -z "$pty" ]; then
+    echo "FAIL rn42emu did not start"
+    exit 1
+fi
+
+status=0
+"$work/rn42test" "$pty" || status=1
+
+kill -INT $emu
+wait $emu || true
+
+expect() {
+    if ! grep -qx "$1" "$work/emu.out"; then
+        echo "FAIL expected '$1' from rn42emu"
+        status=1
+    fi
+}
+
+expect "COMMAND SH,0200"
+expect "keyboard_reports=4"
+expect "keystrokes=2"
+expect "mouse_reports=1"
+expect "unknown_reports=0"
+expect "KEYBOARD mods=0x02 keys=0b 00 00 00 00 00"
+expect "MOUSE buttons=0x00 x=5 y=-3 wheel=0"
+expect "consumer_reports=2"
+expect "CONSUMER 0x00e9"
+
+if [ $status -ne 0 ]; then
+    cat "$work/emu.out"
+fi
+exit $status